@@ -0,0 +1,484 @@
+// Host benchmarks for the firmware's hot paths, against the stand-ins in
+// stubs/. Besides the timings it can write and check the duty table the
+// display produces, so changes to the curve or the dimmer show up as a
+// diff:
+//
+//   lumiere_bench [--nmea FILE]... [--tz FILE] [--iterations N]
+//   lumiere_bench --duty-table > duty_table.golden
+//   lumiere_bench --check-duty duty_table.golden
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "civil_time.hpp"
+#include "drift_model.hpp"
+#include "nightstand_layout.hpp"
+#include "nmea.hpp"
+#include "nmea_time.hpp"
+#include "time_source.hpp"
+#include "tz_index.hpp"
+#include "ubx.hpp"
+#include "utc_sequence.hpp"
+#include "wake_scheduler.hpp"
+
+// Every heap allocation in the process, so a hot path can be checked for
+// staying off the heap
+static size_t allocations = 0;
+
+void *operator new(size_t size) {
+  allocations++;
+  if (void *p = std::malloc(size == 0 ? 1 : size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+// Sensor readings of the duty table, from a dark room (night PWM mode, the
+// minimum scale) to full daylight
+static constexpr float kDutyTableLight[] = {0.0f, 0.03f, 0.06f, 0.1f, 0.2f};
+
+static constexpr int kMinutesPerDay = 24 * 60;
+
+using Clock = std::chrono::steady_clock;
+
+static double elapsed_ns(Clock::time_point start) {
+  return std::chrono::duration<double, std::nano>(Clock::now() - start)
+      .count();
+}
+
+static void add_sentence(std::string &out, const char *body) {
+  uint8_t checksum = 0;
+  for (const char *c = body; *c != '\0'; c++) {
+    checksum ^= static_cast<uint8_t>(*c);
+  }
+  char tail[8];
+  snprintf(tail, sizeof(tail), "*%02X\r\n", checksum);
+  out += '$';
+  out += body;
+  out += tail;
+}
+
+// What a NEO-6M sends per second with a fix, GPS talker, for `epochs`
+// seconds from 2024-03-01. Every 50th epoch loses the tail of a sentence
+// like a UART overrun does.
+static std::string synthetic_corpus(int epochs) {
+  std::string out;
+  char body[kNmeaMaxSentenceLength];
+  for (int epoch = 0; epoch < epochs; epoch++) {
+    const int h = (epoch / 3600) % 24;
+    const int m = (epoch / 60) % 60;
+    const int s = epoch % 60;
+    const int day = 1 + epoch / kSecondsPerDay % 28;
+    snprintf(body, sizeof(body),
+             "GPRMC,%02d%02d%02d.00,A,4807.03812,N,01131.00024,E,0.012,,"
+             "%02d0324,,,A",
+             h, m, s, day);
+    add_sentence(out, body);
+    add_sentence(out, "GPVTG,,T,,M,0.012,N,0.022,K,A");
+    snprintf(body, sizeof(body),
+             "GPGGA,%02d%02d%02d.00,4807.03812,N,01131.00024,E,1,08,1.01,"
+             "519.2,M,46.9,M,,",
+             h, m, s);
+    add_sentence(out, body);
+    add_sentence(out, "GPGSA,A,3,02,05,12,13,15,18,24,25,,,,,2.05,1.01,1.78");
+    add_sentence(out, "GPGSV,3,1,11,02,45,296,33,05,38,221,30,12,71,091,38,"
+                      "13,15,043,24");
+    add_sentence(out, "GPGSV,3,2,11,15,57,128,35,18,09,311,19,24,33,157,31,"
+                      "25,47,069,36");
+    add_sentence(out, "GPGSV,3,3,11,29,06,002,,31,02,260,,36,30,150,");
+    snprintf(body, sizeof(body),
+             "GPGLL,4807.03812,N,01131.00024,E,%02d%02d%02d.00,A,A", h, m, s);
+    add_sentence(out, body);
+    if (epoch % 50 == 49) {
+      out.resize(out.size() - 20);
+    }
+  }
+  return out;
+}
+
+static void put_u32(std::string &out, size_t offset, uint32_t v) {
+  for (int i = 0; i < 4; i++) {
+    out[offset + i] = static_cast<char>((v >> (8 * i)) & 0xff);
+  }
+}
+
+// A stand-in for tools/tz_index_gen.py output: a 1 degree grid of 25
+// zones by longitude, where every fourth cell has a border running into
+// its NE corner down to `depth` levels
+static std::string synthetic_tz_index(int depth) {
+  static constexpr int kColumns = 360;
+  static constexpr int kRows = 180;
+  static constexpr int kZones = 25;
+  const uint32_t grid_offset = kTzIndexHeaderSize;
+  const uint32_t node_offset = grid_offset + kColumns * kRows * 4;
+  const uint32_t zone_offset = node_offset + depth * 16;
+  std::string strings;
+  std::vector<uint32_t> zone_offsets;
+  char record[32];
+  for (int zone = 0; zone < kZones; zone++) {
+    zone_offsets.push_back(zone_offset + kZones * 4 + strings.size());
+    const int hours = zone - 12;
+    const int length = snprintf(record, sizeof(record), "Etc/GMT%+d%c<%+03d>%d",
+                                -hours, '\0', hours, -hours);
+    strings.append(record, length + 1);
+  }
+
+  std::string out(zone_offset + kZones * 4, '\0');
+  out += strings;
+  put_u32(out, 0, kTzIndexMagic);
+  out[4] = kTzIndexVersion;
+  out[6] = kZones;
+  out[8] = kColumns & 0xff;
+  out[9] = kColumns >> 8;
+  out[10] = kRows;
+  put_u32(out, 12, grid_offset);
+  put_u32(out, 16, node_offset);
+  put_u32(out, 20, depth);
+  put_u32(out, 24, zone_offset);
+  put_u32(out, 28, out.size());
+  for (int row = 0; row < kRows; row++) {
+    for (int column = 0; column < kColumns; column++) {
+      const uint32_t zone = (column + 7) / 15 % kZones;
+      const bool border = depth > 0 && (row + column) % 4 == 0;
+      put_u32(out, grid_offset + (row * kColumns + column) * 4,
+              border ? 0 : kTzRefLeaf | zone);
+    }
+  }
+  // Node i splits into three leaves and node i + 1 in the NE quarter
+  for (int node = 0; node < depth; node++) {
+    const uint32_t offset = node_offset + node * 16;
+    put_u32(out, offset, kTzRefLeaf | (node % kZones));
+    put_u32(out, offset + 4, kTzRefLeaf | ((node + 1) % kZones));
+    put_u32(out, offset + 8, kTzRefLeaf | ((node + 2) % kZones));
+    put_u32(out, offset + 12,
+            node + 1 < depth ? node + 1 : kTzRefLeaf | (node % kZones));
+  }
+  for (int zone = 0; zone < kZones; zone++) {
+    put_u32(out, zone_offset + zone * 4, zone_offsets[zone]);
+  }
+  return out;
+}
+
+static bool read_file(const char *path, std::string &out) {
+  FILE *f = fopen(path, "rb");
+  if (f == nullptr) {
+    return false;
+  }
+  char buffer[4096];
+  size_t length;
+  while ((length = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+    out.append(buffer, length);
+  }
+  fclose(f);
+  return true;
+}
+
+// The receive path of gps_acquisition without the UART: every byte through
+// both framers, every sentence through the time readers and the sequence
+// check
+static void bench_nmea(const std::string &corpus, int iterations) {
+  size_t sentences = 0;
+  size_t readings = 0;
+  size_t accepted = 0;
+  const size_t allocations_before = allocations;
+  const auto start = Clock::now();
+  for (int i = 0; i < iterations; i++) {
+    NmeaParser parser;
+    UbxParser ubx_parser;
+    UtcSequenceCheck sequence(0);
+    // Stands in for the system clock, which the first dated time sets.
+    // The receiver is taken to be perfectly on time.
+    int64_t local_us = 0;
+    for (const char c : corpus) {
+      const auto byte = static_cast<uint8_t>(c);
+      ubx_parser.feed(byte);
+      if (!parser.feed(byte)) {
+        continue;
+      }
+      sentences++;
+      const auto reading = nmea_read_time(parser.sentence());
+      if (!reading) {
+        continue;
+      }
+      readings++;
+      const auto utc_us =
+          nmea_reading_utc_us(*reading, local_us, local_us != 0);
+      if (utc_us && sequence.confirm(*utc_us, *utc_us)) {
+        accepted++;
+      }
+      if (utc_us) {
+        local_us = *utc_us;
+      }
+    }
+  }
+  const double ns = elapsed_ns(start);
+  const size_t allocated = allocations - allocations_before;
+  const size_t bytes = corpus.size() * iterations;
+  printf("nmea: %zu bytes, %zu sentences, %zu time readings, %zu accepted\n",
+         bytes, sentences, readings, accepted);
+  printf("nmea: %.0f sentences/s, %.1f MB/s, %.1f ns/sentence, %.3f "
+         "allocations/sentence\n",
+         sentences / ns * 1e9, bytes / ns * 1e3, ns / sentences,
+         sentences > 0 ? static_cast<double>(allocated) / sentences : 0.0);
+}
+
+static tm minute_of_day(int minute) {
+  tm timeinfo{};
+  timeinfo.tm_hour = minute / 60;
+  timeinfo.tm_min = minute % 60;
+  return timeinfo;
+}
+
+// One wake's display work: the frame itself, and how long to sleep after
+static void bench_display(int iterations) {
+  ClockLeds leds;
+  uint64_t checksum = 0;
+  size_t frames = 0;
+  const size_t allocations_before = allocations;
+  auto start = Clock::now();
+  for (int i = 0; i < iterations; i++) {
+    for (const float light : kDutyTableLight) {
+      for (int minute = 0; minute < kMinutesPerDay; minute++) {
+        leds.update(minute_of_day(minute), light, 60000);
+        checksum += host_ledc_channels[0].duty;
+        frames++;
+      }
+    }
+  }
+  const double update_ns = elapsed_ns(start);
+
+  start = Clock::now();
+  for (int i = 0; i < iterations; i++) {
+    for (const float light : kDutyTableLight) {
+      for (int minute = 0; minute < kMinutesPerDay; minute++) {
+        checksum +=
+            leds.seconds_until_update(minute_of_day(minute), light, 60, 3600);
+      }
+    }
+  }
+  const double until_ns = elapsed_ns(start);
+  printf("display: %.1f ns/frame update, %.1f ns/frame "
+         "seconds_until_update, %zu allocations (checksum %llu)\n",
+         update_ns / frames, until_ns / frames,
+         allocations - allocations_before,
+         static_cast<unsigned long long>(checksum));
+}
+
+// Everything main decides about syncing on a wake, without the sync itself
+static void bench_time_sync(int iterations) {
+  DriftModel drift{};
+  int64_t utc_us = utc_seconds(2024, 3, 1, 0, 0, 0) * 1000000;
+  // A clock running 20 ppm fast, synced once a day
+  for (int day = 0; day < 4; day++) {
+    drift_model_on_sync(drift, utc_us + day * 1728000LL, utc_us);
+    utc_us += kSecondsPerDay * 1000000LL;
+  }
+  GpsAttemptStats gps{};
+  gps.attempts = 10;
+  gps.failures = 2;
+  gps.on_time_s = 400;
+  gps.ttf_sum_s = 280;
+  SntpStats sntp{};
+  sntp.attempts = 10;
+  sntp.failures = 1;
+  sntp.radio_ms_sum = 9 * 600;
+  sntp.last_delay_us = 20000;
+
+  size_t decisions = 0;
+  int64_t checksum = 0;
+  const auto start = Clock::now();
+  for (int i = 0; i < iterations * 10000; i++) {
+    const int64_t now_us = utc_us + i * 60000000LL;
+    const int64_t now = now_us / 1000000;
+    // Keeps the compiler from hoisting the decision out of the loop
+    gps.on_time_s = 400 + (i & 63);
+    const int64_t next_resync = drift_model_next_resync(drift);
+    const TimeSourceOption options[] = {
+        time_source_gps_option(gps, now),
+        time_source_sntp_option(sntp, now, true)};
+    const TimeSource source = time_source_select(options, 2, false);
+    const int64_t next_attempt =
+        time_source_next_attempt(gps, sntp, now, true);
+    const WakePlan plan = plan_wake(
+        now_us, 600, next_resync > next_attempt ? next_resync : next_attempt);
+    checksum += plan.sleep_us + static_cast<int>(source);
+    decisions++;
+  }
+  const double ns = elapsed_ns(start);
+  printf("time sync: %.1f ns/decision (checksum %lld)\n", ns / decisions,
+         static_cast<long long>(checksum));
+}
+
+// Position to zone, over random points of the world. Points spread evenly
+// mostly land in open sea, which a real index resolves at the grid.
+static void bench_tz_lookup(const std::string &data, int iterations) {
+  const TzIndex index(reinterpret_cast<const uint8_t *>(data.data()),
+                      data.size());
+  static constexpr int kPoints = 4096;
+  int32_t latitude_e7[kPoints];
+  int32_t longitude_e7[kPoints];
+  uint32_t seed = 1;
+  for (int i = 0; i < kPoints; i++) {
+    seed = seed * 1664525u + 1013904223u;
+    latitude_e7[i] = static_cast<int32_t>(seed % 1800000000u) - 900000000;
+    seed = seed * 1664525u + 1013904223u;
+    longitude_e7[i] = static_cast<int32_t>(seed % 3600000000u) - 1800000000;
+  }
+
+  size_t lookups = 0;
+  size_t unknown = 0;
+  int64_t depth_sum = 0;
+  int max_depth = 0;
+  const size_t allocations_before = allocations;
+  const auto start = Clock::now();
+  for (int i = 0; i < iterations * 100; i++) {
+    for (int p = 0; p < kPoints; p++) {
+      int depth;
+      if (index.lookup(latitude_e7[p], longitude_e7[p], &depth) ==
+          kTzZoneNone) {
+        unknown++;
+      }
+      depth_sum += depth;
+      max_depth = depth > max_depth ? depth : max_depth;
+      lookups++;
+    }
+  }
+  const double ns = elapsed_ns(start);
+  printf("tz: %zu byte index, %u zones, %zu of %zu lookups unknown\n",
+         index.size(), index.zone_count(), unknown, lookups);
+  printf("tz: %.1f ns/lookup, %d levels max, %.2f mean, %zu allocations\n",
+         ns / lookups, max_depth, static_cast<double>(depth_sum) / lookups,
+         allocations - allocations_before);
+}
+
+// One line per light level and minute of the day: the PWM resolution and
+// each channel's duty. A fresh LedTime per light level, the PWM mode
+// depends on the light before.
+static std::string duty_table() {
+  std::string out;
+  char line[128];
+  for (const float light : kDutyTableLight) {
+    ClockLeds leds;
+    for (int minute = 0; minute < kMinutesPerDay; minute++) {
+      leds.update(minute_of_day(minute), light);
+      int length = snprintf(line, sizeof(line), "%.2f %02d:%02d %2d", light,
+                            minute / 60, minute % 60,
+                            static_cast<int>(host_ledc_timer.duty_resolution));
+      for (const auto &led : NightstandLayout::kLeds) {
+        length += snprintf(line + length, sizeof(line) - length, " %5lu",
+                           static_cast<unsigned long>(
+                               host_ledc_channels[led.channel].duty));
+      }
+      out += line;
+      out += '\n';
+    }
+  }
+  return out;
+}
+
+static int check_duty_table(const char *path) {
+  std::string golden;
+  if (!read_file(path, golden)) {
+    fprintf(stderr, "Can't read %s\n", path);
+    return 2;
+  }
+  const std::string table = duty_table();
+  if (table == golden) {
+    printf("duty table matches %s\n", path);
+    return 0;
+  }
+  // Report the first line that differs
+  size_t line_start = 0;
+  int line = 1;
+  for (size_t i = 0; i < table.size() && i < golden.size(); i++) {
+    if (table[i] != golden[i]) {
+      break;
+    }
+    if (table[i] == '\n') {
+      line_start = i + 1;
+      line++;
+    }
+  }
+  const size_t expected_end = golden.find('\n', line_start);
+  const size_t actual_end = table.find('\n', line_start);
+  fprintf(stderr, "duty table differs from %s at line %d\n", path, line);
+  fprintf(stderr, "  expected: %s\n",
+          golden.substr(line_start, expected_end - line_start).c_str());
+  fprintf(stderr, "  actual:   %s\n",
+          table.substr(line_start, actual_end - line_start).c_str());
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  std::vector<const char *> corpora;
+  const char *tz_path = nullptr;
+  int iterations = 20;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--nmea") == 0 && i + 1 < argc) {
+      corpora.push_back(argv[++i]);
+    } else if (strcmp(argv[i], "--tz") == 0 && i + 1 < argc) {
+      tz_path = argv[++i];
+    } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+      iterations = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--duty-table") == 0) {
+      fputs(duty_table().c_str(), stdout);
+      return 0;
+    } else if (strcmp(argv[i], "--check-duty") == 0 && i + 1 < argc) {
+      return check_duty_table(argv[++i]);
+    } else if (strcmp(argv[i], "--log") == 0) {
+      host_log_enabled = true;
+    } else {
+      fprintf(stderr,
+              "usage: %s [--nmea FILE]... [--tz FILE] [--iterations N] "
+              "[--log]\n"
+              "       %s --duty-table | --check-duty FILE\n",
+              argv[0], argv[0]);
+      return 2;
+    }
+  }
+  if (iterations < 1) {
+    iterations = 1;
+  }
+
+  std::string corpus;
+  for (const char *path : corpora) {
+    if (!read_file(path, corpus)) {
+      fprintf(stderr, "Can't read %s\n", path);
+      return 2;
+    }
+  }
+  if (corpora.empty()) {
+    corpus = synthetic_corpus(3600);
+  }
+
+  std::string tz_index;
+  if (tz_path != nullptr) {
+    if (!read_file(tz_path, tz_index)) {
+      fprintf(stderr, "Can't read %s\n", tz_path);
+      return 2;
+    }
+    if (!TzIndex(reinterpret_cast<const uint8_t *>(tz_index.data()),
+                 tz_index.size())
+             .valid()) {
+      fprintf(stderr, "%s is no timezone index\n", tz_path);
+      return 2;
+    }
+  } else {
+    tz_index = synthetic_tz_index(6);
+  }
+
+  bench_nmea(corpus, iterations);
+  bench_display(iterations);
+  bench_time_sync(iterations);
+  bench_tz_lookup(tz_index, iterations);
+  return 0;
+}
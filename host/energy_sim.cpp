@@ -0,0 +1,497 @@
+// Discrete-event energy simulator. Runs the firmware's wake_cycle() on a
+// virtual clock, from one wake to the next, so its policies are the real
+// ones: power tiers from the battery model, display wakes and fades from
+// LedTime, drift correction and resync times from the drift model, the
+// choice between GPS and SNTP and the GPS backoff. Peripherals are
+// modelled behind its WakeIo hooks: the cell by its capacity and OCV
+// curve, the light sensor, the sky and the SNTP server by a scripted daily
+// profile, the oscillator by a fixed drift.
+//
+// Every state draws a configurable current. The result is the runtime until
+// the cell is too low to show the time, and where the charge went.
+//
+//   lumiere_sim [--light 0:0,7:0.05,...] [--sky 0:45,...] [--sntp 0:1,...]
+//               [--daily] ...
+//
+// See usage() for all options. The policies themselves are compiled in, so
+// compare two of them by building both.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <utility>
+#include <vector>
+
+#include "battery_model.hpp"
+#include "civil_time.hpp"
+#include "drift_model.hpp"
+#include "gps_backoff.hpp"
+#include "nightstand_layout.hpp"
+#include "persistent_state.hpp"
+#include "time_source.hpp"
+#include "wake_cycle.hpp"
+#include "wifi_time.hpp"
+
+enum class Subsystem : uint8_t {
+  kLightSleep, // CPU in light sleep, LEDC running from RC_FAST
+  kLeds,
+  kCpu,
+  kGps,
+  kWifi,
+  kNvs,
+  kDeepSleep,
+  kCount,
+};
+
+static const char *subsystem_name(Subsystem subsystem) {
+  static const char *kNames[] = {"light sleep", "LEDs", "CPU",       "GPS",
+                                 "Wi-Fi",       "NVS",  "deep sleep"};
+  return kNames[static_cast<size_t>(subsystem)];
+}
+
+// Step function over the hour of the day: each entry holds from its hour
+// until the next one, the last one wraps around midnight
+using DailyProfile = std::vector<std::pair<int, double>>;
+
+static double profile_at(const DailyProfile &profile, int hour) {
+  double value = profile.back().second;
+  for (const auto &entry : profile) {
+    if (entry.first <= hour) {
+      value = entry.second;
+    }
+  }
+  return value;
+}
+
+// "h:value,h:value,..."
+static bool parse_profile(const char *text, DailyProfile &profile) {
+  profile.clear();
+  while (*text != '\0') {
+    char *end;
+    const long hour = strtol(text, &end, 10);
+    if (end == text || *end != ':' || hour < 0 || hour > 23) {
+      return false;
+    }
+    text = end + 1;
+    const double value = strtod(text, &end);
+    if (end == text || (*end != ',' && *end != '\0')) {
+      return false;
+    }
+    profile.emplace_back(static_cast<int>(hour), value);
+    text = *end == ',' ? end + 1 : end;
+  }
+  for (size_t i = 1; i < profile.size(); i++) {
+    if (profile[i].first <= profile[i - 1].first) {
+      return false;
+    }
+  }
+  return !profile.empty();
+}
+
+struct SimConfig {
+  double capacity_mah = 3000;
+  double max_days = 365;
+  int64_t start_time = utc_seconds(2024, 3, 1, 0, 0, 0);
+  double drift_ppm = 20;
+
+  double light_sleep_ma = 0.8;
+  double led_full_ma = 2.0; // per LED at full duty
+  double awake_ma = kAwakeCurrentMa;
+  double wake_ms = 30; // light sensor burst, battery check, display update
+  double gps_ma = kGpsActiveCurrentMa;
+  double wifi_ma = kWifiActiveCurrentMa;
+  double wifi_ms = 0; // radio time of an SNTP sync, 0 without Wi-Fi
+  double nvs_ma = 60;
+  double nvs_ms = 25;
+  double deep_sleep_ma = 0.01;
+  double stub_ms = 2; // wake stub checking the cell
+
+  // Sensor reading, 0..1 of full scale
+  DailyProfile light = {{0, 0.0}, {7, 0.05}, {8, 0.15}, {18, 0.08}, {22, 0.0}};
+  // Seconds to a fix, 0 for none within any budget
+  DailyProfile sky = {{0, 45}};
+  // Whether a sync gets through, 0 for no access point or no answer
+  DailyProfile sntp = {{0, 1}};
+  bool daily = false;
+};
+
+class Simulation {
+public:
+  explicit Simulation(const SimConfig &config)
+      : m_config(config), m_true_us(config.start_time * 1000000),
+        m_io(make_io()) {}
+
+  void run() {
+    const int64_t end_us =
+        m_true_us + static_cast<int64_t>(m_config.max_days * 86400e6);
+    m_start_us = m_true_us;
+    while (m_true_us < end_us && !cell_empty()) {
+      if (!wake()) {
+        break;
+      }
+    }
+    m_shutdown_us = m_true_us;
+    // Deep sleep with the firmware's backoff until the cell is empty
+    uint8_t shutdown_wakes = 0;
+    while (m_true_us < end_us && !cell_empty()) {
+      const double sleep_s = shutdown_sleep_s(shutdown_wakes);
+      spend(Subsystem::kDeepSleep, m_config.deep_sleep_ma, sleep_s);
+      spend(Subsystem::kCpu, m_config.awake_ma, m_config.stub_ms / 1000);
+      advance(sleep_s, sleep_s);
+      m_tier_s[static_cast<size_t>(PowerTier::kShutdown)] += sleep_s;
+      if (shutdown_wakes < UINT8_MAX) {
+        shutdown_wakes++;
+      }
+    }
+  }
+
+  void report(double wall_s) const {
+    const double shown_days = (m_shutdown_us - m_start_us) / 86400e6;
+    const double total_days = (m_true_us - m_start_us) / 86400e6;
+    printf("Simulated %.1f days in %.2f s, %llu wakes\n", total_days, wall_s,
+           static_cast<unsigned long long>(m_wakes));
+    if (m_reached_shutdown) {
+      printf("Display on for %.1f days until the shutdown tier", shown_days);
+    } else {
+      printf("Display still on after %.1f days", shown_days);
+    }
+    printf(", cell %s after %.1f days\n", cell_empty() ? "empty" : "not empty",
+           total_days);
+    printf("Average current %.3f mA while the display was on\n",
+           m_display_mas / ((m_shutdown_us - m_start_us) / 1e6));
+
+    printf("Time per tier:");
+    for (size_t i = 0; i < static_cast<size_t>(PowerTier::kCount); i++) {
+      printf(" %s %.1f d", kPowerPolicies[i].name, m_tier_s[i] / 86400);
+    }
+    printf("\n");
+
+    const double total_mas = used_mas();
+    printf("Charge used: %.0f mAh of %.0f mAh\n", total_mas / 3600,
+           m_config.capacity_mah);
+    for (size_t i = 0; i < static_cast<size_t>(Subsystem::kCount); i++) {
+      printf("  %-12s %8.1f mAh %5.1f%%\n",
+             subsystem_name(static_cast<Subsystem>(i)), m_spent_mas[i] / 3600,
+             total_mas > 0 ? 100 * m_spent_mas[i] / total_mas : 0.0);
+    }
+    printf("GPS: %lu attempts, %lu failures, %lu s on. SNTP: %lu syncs, %lu "
+           "failures. NVS: %lu writes\n",
+           static_cast<unsigned long>(m_state.gps.attempts),
+           static_cast<unsigned long>(m_state.gps.failures),
+           static_cast<unsigned long>(m_state.gps.on_time_s),
+           static_cast<unsigned long>(m_state.sntp.attempts -
+                                      m_state.sntp.failures),
+           static_cast<unsigned long>(m_state.sntp.failures),
+           static_cast<unsigned long>(m_nvs_writes));
+    printf("Clock error after the first sync: max %.3f s, drift estimate %ld "
+           "ppb (actual %.0f ppb)\n",
+           m_max_error_us / 1e6, static_cast<long>(m_state.drift.drift_ppb),
+           m_config.drift_ppm * 1000);
+  }
+
+private:
+  const SimConfig &m_config;
+  int64_t m_true_us;
+  int64_t m_local_us = 0; // the ESP32 boots at the epoch
+  int64_t m_start_us = 0;
+  int64_t m_shutdown_us = 0;
+  bool m_reached_shutdown = false;
+
+  BatteryEstimate m_battery{};
+  PersistentState m_state{};
+  ClockLeds m_leds;
+  const WakeIo m_io;
+  double m_leds_awake = 0; // LED fraction during the current wake
+  int64_t m_last_nvs_write = 0;
+
+  double m_spent_mas[static_cast<size_t>(Subsystem::kCount)] = {};
+  double m_display_mas = 0;
+  double m_tier_s[static_cast<size_t>(PowerTier::kCount)] = {};
+  uint64_t m_wakes = 0;
+  uint32_t m_nvs_writes = 0;
+  double m_max_error_us = 0;
+  int m_last_reported_day = -1;
+
+  double used_mas() const {
+    double used = 0;
+    for (const double mas : m_spent_mas) {
+      used += mas;
+    }
+    return used;
+  }
+
+  bool cell_empty() const {
+    return used_mas() >= m_config.capacity_mah * 3600;
+  }
+
+  int32_t soc_permille() const {
+    const double soc =
+        1000 * (1 - used_mas() / (m_config.capacity_mah * 3600));
+    return soc > 0 ? static_cast<int32_t>(soc) : 0;
+  }
+
+  void spend(Subsystem subsystem, double ma, double seconds) {
+    m_spent_mas[static_cast<size_t>(subsystem)] += ma * seconds;
+    if (!m_reached_shutdown) {
+      m_display_mas += ma * seconds;
+    }
+  }
+
+  // Real time and the drifting local clock, which runs `seconds` local
+  // while `true_s` pass
+  void advance(double true_s, double local_s) {
+    m_true_us += static_cast<int64_t>(true_s * 1e6);
+    m_local_us += static_cast<int64_t>(local_s * 1e6);
+  }
+
+  void advance_true(double seconds) {
+    advance(seconds, seconds * (1 + m_config.drift_ppm * 1e-6));
+  }
+
+  // LEDs and the sleeping CPU while something else happens, or nothing
+  void idle(double seconds, double led_fraction) {
+    spend(Subsystem::kLightSleep, m_config.light_sleep_ma, seconds);
+    spend(Subsystem::kLeds, m_config.led_full_ma * led_fraction, seconds);
+  }
+
+  // Sum over the LEDs of their duty as a fraction of full
+  static double led_fraction() {
+    const double max_duty = (1u << host_ledc_timer.duty_resolution) - 1;
+    double sum = 0;
+    for (const auto &led : NightstandLayout::kLeds) {
+      sum += host_ledc_channels[led.channel].duty / max_duty;
+    }
+    return sum;
+  }
+
+  int true_hour() const {
+    return static_cast<int>((m_true_us / 1000000) % kSecondsPerDay / 3600);
+  }
+
+  void write_nvs() {
+    spend(Subsystem::kNvs, m_config.nvs_ma, m_config.nvs_ms / 1000);
+    m_nvs_writes++;
+    m_last_nvs_write = m_local_us / 1000000;
+  }
+
+  // Sets the local clock to the real time, like a sync does, and feeds the
+  // drift model and the sync bookkeeping of persistent_state_record_sync()
+  void sync_clock() {
+    drift_model_on_sync(m_state.drift, m_local_us, m_true_us);
+    m_local_us = m_true_us;
+    m_state.last_sync_time = m_true_us / 1000000;
+    // Every resync starts a new session, which goes to NVS right away
+    write_nvs();
+  }
+
+  void attempt_gps(bool first) {
+    const uint32_t budget_s = gps_attempt_budget_ms(first) / 1000;
+    const double ttf_s = profile_at(m_config.sky, true_hour());
+    const bool fix = ttf_s > 0 && ttf_s <= budget_s;
+    const double on_s = fix ? ttf_s : budget_s;
+    spend(Subsystem::kGps, m_config.gps_ma, on_s);
+    idle(on_s, m_leds_awake);
+    advance_true(on_s);
+    if (fix) {
+      gps_attempt_on_success(m_state.gps, static_cast<uint32_t>(on_s));
+      m_state.position.time = m_true_us / 1000000;
+      sync_clock();
+    } else {
+      gps_attempt_on_failure(m_state.gps, static_cast<uint32_t>(on_s),
+                             m_local_us / 1000000);
+    }
+  }
+
+  void attempt_sntp() {
+    const bool synced = profile_at(m_config.sntp, true_hour()) > 0;
+    // A failed sync waits out both connect timeouts
+    const double on_s =
+        synced ? m_config.wifi_ms / 1000
+               : (kWifiFastPathTimeoutMs + kWifiSlowPathTimeoutMs) / 1000.0;
+    spend(Subsystem::kWifi, m_config.wifi_ma, on_s);
+    advance_true(on_s);
+    if (synced) {
+      sntp_attempt_on_success(m_state.sntp,
+                              static_cast<uint32_t>(m_config.wifi_ms), 20000);
+      sync_clock();
+    } else {
+      sntp_attempt_on_failure(m_state.sntp, m_local_us / 1000000);
+    }
+  }
+
+  void report_day() {
+    const int day = static_cast<int>((m_true_us - m_start_us) / 86400000000LL);
+    if (!m_config.daily || day == m_last_reported_day) {
+      return;
+    }
+    m_last_reported_day = day;
+    printf("day %3d: SoC %4ld permille, tier %-8s, trend %ld permille/day\n",
+           day, static_cast<long>(soc_permille()),
+           power_policy(m_battery.tier).name,
+           static_cast<long>(m_battery.trend_permille_per_day));
+  }
+
+  // The cell, read under load. Like the firmware, an empty one ends the
+  // wake cycles.
+  const PowerPolicy *check_battery() {
+    const uint32_t loaded_mv =
+        soc_permille_to_ocv(soc_permille()) - kLoadCorrectionMv;
+    battery_update(m_battery, loaded_mv, m_local_us / 1000000);
+    report_day();
+    if (m_battery.tier == PowerTier::kShutdown) {
+      m_reached_shutdown = true;
+      write_nvs();
+      return nullptr;
+    }
+    return &power_policy(m_battery.tier);
+  }
+
+  // Sleep, timed by the drifting local clock
+  void sleep(uint64_t sleep_us) {
+    if (m_state.last_sync_time != 0) {
+      const double error_us = std::fabs(double(m_local_us - m_true_us));
+      m_max_error_us = std::max(m_max_error_us, error_us);
+    }
+    // The fade is linear, on average halfway
+    const double leds_sleeping = (m_leds_awake + led_fraction()) / 2;
+    const double sleep_local_s = sleep_us / 1e6;
+    const double sleep_true_s = sleep_local_s / (1 + m_config.drift_ppm * 1e-6);
+    idle(sleep_true_s, leds_sleeping);
+    m_tier_s[static_cast<size_t>(m_battery.tier)] +=
+        sleep_true_s + m_config.wake_ms / 1000;
+    advance(sleep_true_s, sleep_local_s);
+  }
+
+  WakeIo make_io() {
+    return {
+        .read_light =
+            [this] {
+              return static_cast<float>(
+                  profile_at(m_config.light, true_hour()));
+            },
+        .check_battery = [this] { return check_battery(); },
+        .now_us = [this] { return m_local_us; },
+        .set_time_us = [this](int64_t utc_us) { m_local_us = utc_us; },
+        .local_time = [](time_t utc, tm &local) {
+          civil_breakdown(utc, local);
+        },
+        .attempt_gps = [this](bool first) { attempt_gps(first); },
+        .attempt_sntp = [this] { attempt_sntp(); },
+        .sntp_configured = m_config.wifi_ms > 0,
+        .state = [this] { return m_state; },
+        .set_state =
+            [this](const PersistentState &state) { m_state = state; },
+        // Drift correction alone leaves the state dirty on every wake, so
+        // it goes to NVS once a day
+        .commit =
+            [this](time_t now) {
+              if (now - m_last_nvs_write >= 86400) {
+                write_nvs();
+              }
+            },
+        .sleep = [this](uint64_t sleep_us) { sleep(sleep_us); },
+    };
+  }
+
+  // One wake cycle and the sleep after it. Returns false once the cell
+  // sends the clock to deep sleep.
+  bool wake() {
+    m_wakes++;
+    const double wake_s = m_config.wake_ms / 1000;
+    spend(Subsystem::kCpu, m_config.awake_ma, wake_s);
+    m_leds_awake = led_fraction();
+    spend(Subsystem::kLeds, m_config.led_full_ma * m_leds_awake, wake_s);
+    advance_true(wake_s);
+    return wake_cycle(m_io, m_leds);
+  }
+};
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  --capacity MAH       cell capacity (3000)\n"
+          "  --days N             stop after N days (365)\n"
+          "  --drift-ppm PPM      oscillator drift, positive runs fast (20)\n"
+          "  --light H:V,...      light sensor reading 0..1 by hour of day\n"
+          "  --sky H:S,...        GPS seconds to fix by hour, 0 for none\n"
+          "  --sntp H:A,...       SNTP sync by hour, 1 gets through, 0 fails\n"
+          "  --wifi-ms MS         radio time of an SNTP sync, 0 = no Wi-Fi\n"
+          "  --sleep-ma MA        light sleep with LEDC running (0.8)\n"
+          "  --led-ma MA          one LED at full duty (2.0)\n"
+          "  --awake-ma MA        CPU awake (40)\n"
+          "  --wake-ms MS         awake time per wake (30)\n"
+          "  --gps-ma MA          receiver acquiring (25)\n"
+          "  --wifi-ma MA         radio on (110)\n"
+          "  --nvs-ma MA          NVS commit (60)\n"
+          "  --nvs-ms MS          NVS commit duration (25)\n"
+          "  --deep-sleep-ma MA   deep sleep (0.01)\n"
+          "  --daily              print the battery estimate once a day\n"
+          "  --log                show the firmware's log output\n",
+          name);
+}
+
+int main(int argc, char **argv) {
+  SimConfig config;
+  struct NumberOption {
+    const char *name;
+    double *value;
+  } const number_options[] = {
+      {"--capacity", &config.capacity_mah},
+      {"--days", &config.max_days},
+      {"--drift-ppm", &config.drift_ppm},
+      {"--wifi-ms", &config.wifi_ms},
+      {"--sleep-ma", &config.light_sleep_ma},
+      {"--led-ma", &config.led_full_ma},
+      {"--awake-ma", &config.awake_ma},
+      {"--wake-ms", &config.wake_ms},
+      {"--gps-ma", &config.gps_ma},
+      {"--wifi-ma", &config.wifi_ma},
+      {"--nvs-ma", &config.nvs_ma},
+      {"--nvs-ms", &config.nvs_ms},
+      {"--deep-sleep-ma", &config.deep_sleep_ma},
+  };
+
+  for (int i = 1; i < argc; i++) {
+    bool parsed = false;
+    for (const auto &option : number_options) {
+      if (strcmp(argv[i], option.name) == 0 && i + 1 < argc) {
+        *option.value = atof(argv[++i]);
+        parsed = true;
+      }
+    }
+    if (parsed) {
+      continue;
+    }
+    if (strcmp(argv[i], "--light") == 0 && i + 1 < argc) {
+      parsed = parse_profile(argv[++i], config.light);
+    } else if (strcmp(argv[i], "--sky") == 0 && i + 1 < argc) {
+      parsed = parse_profile(argv[++i], config.sky);
+    } else if (strcmp(argv[i], "--sntp") == 0 && i + 1 < argc) {
+      parsed = parse_profile(argv[++i], config.sntp);
+    } else if (strcmp(argv[i], "--daily") == 0) {
+      config.daily = parsed = true;
+    } else if (strcmp(argv[i], "--log") == 0) {
+      host_log_enabled = parsed = true;
+    }
+    if (!parsed) {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (config.capacity_mah <= 0 || config.max_days <= 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  Simulation simulation(config);
+  simulation.run();
+  const double wall_s = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+  simulation.report(wall_s);
+  return 0;
+}
@@ -0,0 +1,172 @@
+// Feeds receiver output through GpsReader over the host UART, with the
+// events the driver would raise, and checks the epoch GpsEpochTiming gives
+// each sentence and UBX frame: NAV-TIMEUTC before and after the line of its
+// epoch, an ACK in front of a line, a '\n' inside a frame and a reader that
+// runs late. Exits non-zero on a mismatch:
+//
+//   lumiere_gps_reader_test
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "driver/uart.h"
+#include "freertos/queue.h"
+#include "gps_reader.hpp"
+#include "gps_timing.hpp"
+#include "ubx.hpp"
+
+using Bytes = std::vector<uint8_t>;
+
+static constexpr uint32_t kBaud = 9600;
+// Some monotonic time, the first epoch's RMC is in then
+static constexpr int64_t kStartUs = 1000 * 1000000LL;
+// Rounding of the transfer times, one per message
+static constexpr int64_t kToleranceUs = 2;
+
+static const char *const kRmc =
+    "$GPRMC,120000.00,A,5231.20000,N,01324.30000,E,0.0,,010124,,,A*75\r\n";
+static const char *const kGsvStart = "$GPGSV,3,1,12,01,40,083,46,02,17,308,";
+
+// What reached the sink
+struct Message {
+  bool sentence;
+  uint8_t cls; // frames only
+  int64_t epoch_us;
+  bool pps_locked;
+};
+
+static std::vector<Message> messages;
+static QueueHandle_t events = nullptr;
+static int failures = 0;
+
+static void expect(bool ok, const char *what) {
+  if (!ok) {
+    printf("FAILED: %s\n", what);
+    failures++;
+  }
+}
+
+static Bytes text(const char *s) { return Bytes(s, s + strlen(s)); }
+
+static Bytes operator+(Bytes a, const Bytes &b) {
+  a.insert(a.end(), b.begin(), b.end());
+  return a;
+}
+
+static Bytes frame(uint8_t cls, uint8_t id, const Bytes &payload) {
+  Bytes out(payload.size() + kUbxFrameOverhead);
+  ubx_frame(cls, id, payload.data(), payload.size(), out.data());
+  return out;
+}
+
+// A NAV-TIMEUTC whose payload has a '\n' in it
+static Bytes nav_timeutc() {
+  Bytes payload(kUbxNavTimeutcLength, 0);
+  payload[2] = '\n';
+  return frame(kUbxClassNav, kUbxIdNavTimeutc, payload);
+}
+
+static Bytes ack() {
+  return frame(kUbxClassAck, kUbxIdAckAck, {kUbxClassCfg, kUbxIdCfgMsg});
+}
+
+static int64_t transfer_us(size_t bytes) {
+  return gps_uart_transfer_us(static_cast<int>(bytes), kBaud);
+}
+
+// Hands everything queued to the reader, which gets to it at `now_us`
+static void run_reader(GpsReader &reader, int64_t now_us) {
+  uart_event_t event;
+  while (xQueueReceive(events, &event, 0) == pdTRUE) {
+    reader.on_event(event, kBaud, now_us, 0);
+  }
+}
+
+// `bytes` come in, the last one at `end_us`, and the reader runs right away
+static void receive(GpsReader &reader, const Bytes &bytes, int64_t end_us) {
+  host_uart_rx(bytes.data(), bytes.size());
+  run_reader(reader, end_us);
+}
+
+static bool near(int64_t a, int64_t b) {
+  return llabs(a - b) <= kToleranceUs;
+}
+
+static void check(size_t index, bool sentence, int64_t epoch_us,
+                  const char *what) {
+  const bool ok = index < messages.size() &&
+                  messages[index].sentence == sentence &&
+                  near(messages[index].epoch_us, epoch_us) &&
+                  !messages[index].pps_locked;
+  printf("%-44s %s\n", what, ok ? "ok" : "wrong");
+  if (!ok && index < messages.size()) {
+    printf("  epoch %lld us, expected %lld us\n",
+           static_cast<long long>(messages[index].epoch_us),
+           static_cast<long long>(epoch_us));
+  }
+  expect(ok, what);
+}
+
+int main() {
+  events = xQueueCreate(32, sizeof(uart_event_t));
+  host_uart_events = events;
+
+  GpsReaderSink sink;
+  sink.sentence = [](const NmeaSentence &, const GpsEpochTiming &timing) {
+    messages.push_back({true, 0, timing.epoch_us(), timing.pps_locked()});
+    return false;
+  };
+  sink.frame = [](const UbxFrame &f, const GpsEpochTiming &timing) {
+    messages.push_back({false, f.cls, timing.epoch_us(), timing.pps_locked()});
+    return false;
+  };
+  GpsReader reader(UART_NUM_1, events, 16, sink);
+
+  const Bytes rmc = text(kRmc);
+  const Bytes timeutc = nav_timeutc();
+
+  // Epoch 1: RMC, then NAV-TIMEUTC on its own UART_DATA
+  const int64_t epoch1_us = kStartUs - transfer_us(rmc.size()) -
+                            kGpsOutputLatencyUs;
+  receive(reader, rmc, kStartUs);
+  check(0, true, epoch1_us, "RMC");
+  receive(reader, timeutc, kStartUs + transfer_us(timeutc.size()));
+  check(1, false, epoch1_us, "NAV-TIMEUTC after it, same epoch");
+
+  // Epoch 2: NAV-TIMEUTC first, the line right behind it in one read
+  const int64_t end2_us = kStartUs + 2000000;
+  const int64_t epoch2_us = end2_us - transfer_us(timeutc.size()) -
+                            transfer_us(rmc.size()) - kGpsOutputLatencyUs;
+  receive(reader, timeutc + rmc, end2_us);
+  check(2, false, epoch2_us, "NAV-TIMEUTC first, next epoch");
+  check(3, true, epoch2_us, "RMC behind it, same epoch");
+
+  // Epoch 3: an ACK to a command right in front of the line, read with it
+  const int64_t end3_us = kStartUs + 4000000;
+  const int64_t epoch3_us = end3_us - transfer_us(rmc.size()) -
+                            kGpsOutputLatencyUs;
+  receive(reader, ack() + rmc, end3_us);
+  expect(messages.size() == 6 && messages[4].cls == kUbxClassAck,
+         "ACK handed on");
+  check(5, true, epoch3_us, "RMC behind an ACK, ACK not counted");
+
+  // Epoch 4: the reader gets to the line only once part of the next one
+  // is in, the bytes behind the '\n' date it
+  const int64_t end4_us = kStartUs + 6000000;
+  const int64_t epoch4_us = end4_us - transfer_us(rmc.size()) -
+                            kGpsOutputLatencyUs;
+  const Bytes gsv = text(kGsvStart);
+  host_uart_rx(rmc.data(), rmc.size());
+  host_uart_rx(gsv.data(), gsv.size());
+  run_reader(reader, end4_us + transfer_us(gsv.size()));
+  check(6, true, epoch4_us, "RMC read late");
+
+  expect(messages.size() == 7, "nothing else handed on");
+  size_t buffered = 0;
+  uart_get_buffered_data_len(UART_NUM_1, &buffered);
+  expect(buffered == 0, "everything read");
+  printf("%zu messages, %d failures\n", messages.size(), failures);
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
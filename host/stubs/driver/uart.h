@@ -0,0 +1,58 @@
+#pragma once
+
+// Host stand-in for ESP-IDF. What the firmware writes goes to
+// host_uart_tx, which plays the other end of the line. What that end sends
+// comes in through host_uart_rx().
+
+#include <cstddef>
+#include <cstdint>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+typedef enum { UART_NUM_0, UART_NUM_1, UART_NUM_2 } uart_port_t;
+
+typedef enum {
+  UART_DATA,
+  UART_BREAK,
+  UART_BUFFER_FULL,
+  UART_FIFO_OVF,
+  UART_FRAME_ERR,
+  UART_PARITY_ERR,
+  UART_DATA_BREAK,
+  UART_PATTERN_DET,
+  UART_EVENT_MAX,
+} uart_event_type_t;
+
+typedef struct {
+  uart_event_type_t type;
+  size_t size;
+  bool timeout_flag;
+} uart_event_t;
+
+extern void (*host_uart_tx)(const uint8_t *data, size_t size);
+extern uint32_t host_uart_baud_rate;
+
+// Where host_uart_rx() posts the driver's events, none if null
+extern QueueHandle_t host_uart_events;
+// Bytes from the other end, all in at once. They go to the RX ring buffer
+// and every '\n' records its position, like with pattern detection on.
+// Each '\n' raises UART_PATTERN_DET, the bytes after the last one
+// UART_DATA.
+void host_uart_rx(const uint8_t *data, size_t size);
+
+int uart_read_bytes(uart_port_t port, void *buf, uint32_t length,
+                    TickType_t ticks_to_wait);
+esp_err_t uart_get_buffered_data_len(uart_port_t port, size_t *size);
+esp_err_t uart_flush_input(uart_port_t port);
+int uart_pattern_pop_pos(uart_port_t port);
+int uart_pattern_get_pos(uart_port_t port);
+esp_err_t uart_pattern_queue_reset(uart_port_t port, int queue_length);
+
+int uart_write_bytes(uart_port_t port, const void *src, size_t size);
+esp_err_t uart_wait_tx_done(uart_port_t port, TickType_t ticks_to_wait);
+esp_err_t uart_set_baudrate(uart_port_t port, uint32_t baud_rate);
+esp_err_t uart_enable_pattern_det_baud_intr(uart_port_t port, char pattern_chr,
+                                            uint8_t chr_num, int chr_tout,
+                                            int post_idle, int pre_idle);
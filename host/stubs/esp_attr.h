@@ -0,0 +1,5 @@
+#pragma once
+
+// Host stand-in for ESP-IDF, there is no RTC memory to place things in
+
+#define RTC_DATA_ATTR
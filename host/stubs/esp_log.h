@@ -0,0 +1,21 @@
+#pragma once
+
+// Host stand-in for ESP-IDF. Logs go to stderr, and only while
+// host_log_enabled is set, so benchmarks don't time the terminal.
+
+#include <cstdio>
+
+extern bool host_log_enabled;
+
+#define HOST_LOG(level, tag, format, ...)                                      \
+  do {                                                                         \
+    if (host_log_enabled) {                                                    \
+      fprintf(stderr, level " (%s) " format "\n", tag, ##__VA_ARGS__);         \
+    }                                                                          \
+  } while (0)
+
+#define ESP_LOGE(tag, format, ...) HOST_LOG("E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) HOST_LOG("W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) HOST_LOG("I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) HOST_LOG("D", tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) HOST_LOG("V", tag, format, ##__VA_ARGS__)
@@ -0,0 +1,7 @@
+#pragma once
+
+// Host stand-in for ESP-IDF, the host's monotonic clock
+
+#include <cstdint>
+
+int64_t esp_timer_get_time();
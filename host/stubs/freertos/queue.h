@@ -0,0 +1,15 @@
+#pragma once
+
+// Host stand-in for ESP-IDF. Single threaded: a receive on an empty queue
+// lets its whole wait pass on the tick counter and fails.
+
+#include "FreeRTOS.h"
+
+typedef struct HostQueue *QueueHandle_t;
+
+QueueHandle_t xQueueCreate(uint32_t length, uint32_t item_size);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item,
+                      TickType_t ticks_to_wait);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item,
+                         TickType_t ticks_to_wait);
+BaseType_t xQueueReset(QueueHandle_t queue);
@@ -0,0 +1,11 @@
+#pragma once
+
+// Host stand-in for ESP-IDF. Delays return right away, but pass on the
+// tick counter.
+
+#include "FreeRTOS.h"
+
+extern TickType_t host_tick_count;
+
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount();
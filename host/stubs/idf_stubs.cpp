@@ -0,0 +1,217 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+#include <driver/gpio.h>
+#include <driver/ledc.h>
+#include <driver/uart.h>
+#include <esp_log.h>
+#include <esp_sleep.h>
+#include <esp_timer.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+bool host_log_enabled = false;
+
+HostLedcChannel host_ledc_channels[LEDC_CHANNEL_MAX];
+ledc_timer_config_t host_ledc_timer;
+
+void (*host_uart_tx)(const uint8_t *data, size_t size) = nullptr;
+uint32_t host_uart_baud_rate = 0;
+QueueHandle_t host_uart_events = nullptr;
+
+// The RX ring buffer, and the positions of the '\n's in it
+static std::deque<uint8_t> host_uart_rx_buffer;
+static std::deque<int> host_uart_patterns;
+
+TickType_t host_tick_count = 0;
+
+struct HostQueue {
+  uint32_t length;
+  uint32_t item_size;
+  std::deque<std::vector<uint8_t>> items;
+};
+
+esp_err_t gpio_config(const gpio_config_t *config) { return ESP_OK; }
+
+esp_err_t esp_sleep_pd_config(esp_sleep_pd_domain_t domain,
+                              esp_sleep_pd_option_t option) {
+  return ESP_OK;
+}
+
+int64_t esp_timer_get_time() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void vTaskDelay(TickType_t ticks) { host_tick_count += ticks; }
+
+TickType_t xTaskGetTickCount() { return host_tick_count; }
+
+QueueHandle_t xQueueCreate(uint32_t length, uint32_t item_size) {
+  return new HostQueue{length, item_size, {}};
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item,
+                      TickType_t ticks_to_wait) {
+  if (queue->items.size() == queue->length) {
+    return pdFALSE;
+  }
+  const uint8_t *bytes = static_cast<const uint8_t *>(item);
+  queue->items.emplace_back(bytes, bytes + queue->item_size);
+  return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item,
+                         TickType_t ticks_to_wait) {
+  if (queue->items.empty()) {
+    host_tick_count += ticks_to_wait;
+    return pdFALSE;
+  }
+  memcpy(item, queue->items.front().data(), queue->item_size);
+  queue->items.pop_front();
+  return pdTRUE;
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue) {
+  queue->items.clear();
+  return pdTRUE;
+}
+
+int uart_write_bytes(uart_port_t port, const void *src, size_t size) {
+  if (host_uart_tx != nullptr) {
+    host_uart_tx(static_cast<const uint8_t *>(src), size);
+  }
+  return static_cast<int>(size);
+}
+
+void host_uart_rx(const uint8_t *data, size_t size) {
+  size_t after_pattern = 0;
+  for (size_t i = 0; i < size; i++) {
+    host_uart_rx_buffer.push_back(data[i]);
+    after_pattern++;
+    if (data[i] == '\n') {
+      host_uart_patterns.push_back(host_uart_rx_buffer.size() - 1);
+      const uart_event_t event = {UART_PATTERN_DET, after_pattern, false};
+      if (host_uart_events != nullptr) {
+        xQueueSend(host_uart_events, &event, 0);
+      }
+      after_pattern = 0;
+    }
+  }
+  if (after_pattern > 0 && host_uart_events != nullptr) {
+    const uart_event_t event = {UART_DATA, after_pattern, true};
+    xQueueSend(host_uart_events, &event, 0);
+  }
+}
+
+int uart_read_bytes(uart_port_t port, void *buf, uint32_t length,
+                    TickType_t ticks_to_wait) {
+  const size_t count = std::min<size_t>(length, host_uart_rx_buffer.size());
+  uint8_t *out = static_cast<uint8_t *>(buf);
+  for (size_t i = 0; i < count; i++) {
+    out[i] = host_uart_rx_buffer.front();
+    host_uart_rx_buffer.pop_front();
+  }
+  // The driver moves the positions along, and drops the ones read past
+  for (int &pos : host_uart_patterns) {
+    pos -= count;
+  }
+  while (!host_uart_patterns.empty() && host_uart_patterns.front() < 0) {
+    host_uart_patterns.pop_front();
+  }
+  return static_cast<int>(count);
+}
+
+esp_err_t uart_get_buffered_data_len(uart_port_t port, size_t *size) {
+  *size = host_uart_rx_buffer.size();
+  return ESP_OK;
+}
+
+esp_err_t uart_flush_input(uart_port_t port) {
+  host_uart_rx_buffer.clear();
+  host_uart_patterns.clear();
+  return ESP_OK;
+}
+
+int uart_pattern_pop_pos(uart_port_t port) {
+  if (host_uart_patterns.empty()) {
+    return -1;
+  }
+  const int pos = host_uart_patterns.front();
+  host_uart_patterns.pop_front();
+  return pos;
+}
+
+int uart_pattern_get_pos(uart_port_t port) {
+  return host_uart_patterns.empty() ? -1 : host_uart_patterns.front();
+}
+
+esp_err_t uart_pattern_queue_reset(uart_port_t port, int queue_length) {
+  host_uart_patterns.clear();
+  return ESP_OK;
+}
+
+esp_err_t uart_wait_tx_done(uart_port_t port, TickType_t ticks_to_wait) {
+  return ESP_OK;
+}
+
+esp_err_t uart_set_baudrate(uart_port_t port, uint32_t baud_rate) {
+  host_uart_baud_rate = baud_rate;
+  return ESP_OK;
+}
+
+esp_err_t uart_enable_pattern_det_baud_intr(uart_port_t port, char pattern_chr,
+                                            uint8_t chr_num, int chr_tout,
+                                            int post_idle, int pre_idle) {
+  return ESP_OK;
+}
+
+esp_err_t ledc_timer_config(const ledc_timer_config_t *config) {
+  host_ledc_timer = *config;
+  return ESP_OK;
+}
+
+esp_err_t ledc_channel_config(const ledc_channel_config_t *config) {
+  if (config->channel >= LEDC_CHANNEL_MAX) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  host_ledc_channels[config->channel] = {};
+  host_ledc_channels[config->channel].duty = config->duty;
+  return ESP_OK;
+}
+
+esp_err_t ledc_set_duty(ledc_mode_t mode, ledc_channel_t channel,
+                        uint32_t duty) {
+  host_ledc_channels[channel].pending_duty = duty;
+  return ESP_OK;
+}
+
+esp_err_t ledc_update_duty(ledc_mode_t mode, ledc_channel_t channel) {
+  host_ledc_channels[channel].duty = host_ledc_channels[channel].pending_duty;
+  return ESP_OK;
+}
+
+esp_err_t ledc_fade_func_install(int intr_alloc_flags) { return ESP_OK; }
+
+esp_err_t ledc_set_fade_with_time(ledc_mode_t mode, ledc_channel_t channel,
+                                  uint32_t target_duty, int max_fade_time_ms) {
+  host_ledc_channels[channel].fade_target = target_duty;
+  host_ledc_channels[channel].fade_ms = max_fade_time_ms;
+  return ESP_OK;
+}
+
+esp_err_t ledc_fade_start(ledc_mode_t mode, ledc_channel_t channel,
+                          ledc_fade_mode_t fade_mode) {
+  HostLedcChannel &c = host_ledc_channels[channel];
+  c.duty = c.fade_target;
+  c.fades++;
+  return ESP_OK;
+}
+
+esp_err_t ledc_fade_stop(ledc_mode_t mode, ledc_channel_t channel) {
+  return ESP_OK;
+}
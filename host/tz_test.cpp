@@ -0,0 +1,109 @@
+// Checks posix_tz_span() and civil_breakdown() against the host libc's
+// localtime_r() for a set of POSIX zones, every hour from 2000 to 2050 and
+// on both sides of every transition. Exits non-zero on the first few
+// mismatches:
+//
+//   lumiere_tz_test
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include "civil_time.hpp"
+#include "posix_tz.hpp"
+
+static const char *const kZones[] = {
+    "UTC0",
+    "CET-1CEST,M3.5.0,M10.5.0/3",
+    "EST5EDT,M3.2.0,M11.1.0",
+    // Southern hemisphere, DST across the new year
+    "AEST-10AEDT,M10.1.0,M4.1.0/3",
+    "NZST-12NZDT,M9.5.0,M4.1.0/3",
+    "<-04>4<-03>,M9.1.6/24,M4.1.6/24",
+    // Quoted names, fractional offsets
+    "<+0330>-3:30",
+    "<+0545>-5:45",
+    "ACST-9:30ACDT,M10.1.0,M4.1.0/3",
+    // Transition times beyond a day or before midnight
+    "IST-2IDT,M3.4.4/26,M10.5.0",
+    "<-02>2<-01>,M3.5.0/-1,M10.5.0/0",
+    // Day of year rules, with and without February 29th. Rules that cross
+    // into the next year aren't here: glibc evaluates them in the UTC year
+    // only and gets "DST all year" zones wrong around the new year.
+    "XST3XDT,J60/2,J300/2",
+    "YST-2YDT,59/2,299/3",
+    "ZST-1ZDT,J1/3,J365/1",
+};
+
+static const int64_t kFrom = utc_seconds(2000, 1, 1, 0, 0, 0);
+static const int64_t kUntil = utc_seconds(2050, 1, 1, 0, 0, 0);
+
+static int failures = 0;
+
+static void check(const char *zone, const PosixTz &tz, int64_t utc) {
+  const time_t t = static_cast<time_t>(utc);
+  tm expected = {};
+  localtime_r(&t, &expected);
+
+  const PosixTzSpan span = posix_tz_span(tz, utc);
+  tm actual = {};
+  civil_breakdown(utc + span.offset_s, actual);
+
+  if (span.offset_s == expected.tm_gmtoff && span.dst == !!expected.tm_isdst &&
+      actual.tm_year == expected.tm_year && actual.tm_mon == expected.tm_mon &&
+      actual.tm_mday == expected.tm_mday &&
+      actual.tm_hour == expected.tm_hour && actual.tm_min == expected.tm_min &&
+      actual.tm_sec == expected.tm_sec && actual.tm_wday == expected.tm_wday &&
+      actual.tm_yday == expected.tm_yday && span.from <= utc &&
+      utc < span.until) {
+    return;
+  }
+  if (++failures <= 10) {
+    char want[32];
+    char got[32];
+    strftime(want, sizeof(want), "%F %T", &expected);
+    strftime(got, sizeof(got), "%F %T", &actual);
+    printf("%s at %lld: libc %s %+ld%s, posix_tz %s %+ld%s\n", zone,
+           static_cast<long long>(utc), want, expected.tm_gmtoff,
+           expected.tm_isdst ? " DST" : "", got,
+           static_cast<long>(span.offset_s), span.dst ? " DST" : "");
+  }
+}
+
+int main() {
+  int64_t checked = 0;
+  for (const char *zone : kZones) {
+    PosixTz tz;
+    if (!posix_tz_parse(zone, tz)) {
+      printf("%s: doesn't parse\n", zone);
+      failures++;
+      continue;
+    }
+    setenv("TZ", zone, 1);
+    tzset();
+
+    for (int64_t utc = kFrom; utc < kUntil; utc += 3600) {
+      check(zone, tz, utc);
+      checked++;
+    }
+    // Walk the spans, the seconds around each transition are the ones an
+    // off-by-one would get wrong
+    int transitions = 0;
+    for (int64_t utc = kFrom; utc < kUntil;) {
+      const PosixTzSpan span = posix_tz_span(tz, utc);
+      if (span.until >= kUntil) {
+        break;
+      }
+      check(zone, tz, span.until - 1);
+      check(zone, tz, span.until);
+      checked += 2;
+      transitions++;
+      utc = span.until;
+    }
+    printf("%-36s %3d transitions\n", zone, transitions);
+  }
+  printf("%lld instants, %d mismatches\n", static_cast<long long>(checked),
+         failures);
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,367 @@
+// A scripted u-blox receiver on the other end of the GPS UART, for the UBX
+// helpers and src/gps_control.cpp. Every frame the firmware writes is
+// picked up and checked against frames from the u-blox protocol spec. The
+// receiver answers from a script, each answer right behind an NMEA
+// sentence with no line after it until the next answer. Its bytes come in
+// over the host UART and go through GpsReader, driven by the events the
+// driver would raise, before the ACKs reach gps_control_on_frame(). Also
+// checks the NMEA fields the clock relies on. Exits non-zero on a mismatch:
+//
+//   lumiere_ubx_test
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <sys/time.h>
+#include <vector>
+
+#include "driver/uart.h"
+#include "esp_timer.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "gps_control.hpp"
+#include "gps_reader.hpp"
+#include "nmea.hpp"
+#include "nmea_time.hpp"
+#include "persistent_state.hpp"
+#include "ubx.hpp"
+
+using Bytes = std::vector<uint8_t>;
+
+// RXM-PMREQ, backup until woken up
+static const Bytes kRxmPmreqBackup = {0xb5, 0x62, 0x02, 0x41, 0x08, 0x00,
+                                      0x00, 0x00, 0x00, 0x00, 0x02, 0x00,
+                                      0x00, 0x00, 0x4d, 0x3b};
+// CFG-PRT, UART1 8N1 at 38400, UBX and NMEA in and out
+static const Bytes kCfgPrt38400 = {
+    0xb5, 0x62, 0x06, 0x00, 0x14, 0x00, 0x01, 0x00, 0x00, 0x00,
+    0xd0, 0x08, 0x00, 0x00, 0x00, 0x96, 0x00, 0x00, 0x03, 0x00,
+    0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x8f, 0x70};
+// CFG-MSG, GGA off
+static const Bytes kCfgMsgGgaOff = {0xb5, 0x62, 0x06, 0x01, 0x03, 0x00,
+                                    0xf0, 0x00, 0x00, 0xfa, 0x0f};
+// AID-INI for 52.52 N 13.405 E +/- 10 km at 2024-01-01 00:00:00.250 UTC
+// +/- 1.5 s: week 2295, TOW 86418250 ms, flags pos | time | lla | no alt
+static const Bytes kAidIni = {
+    0xb5, 0x62, 0x0b, 0x01, 0x30, 0x00, 0x80, 0xea, 0x4d, 0x1f, 0xd0, 0x70,
+    0xfd, 0x07, 0x00, 0x00, 0x00, 0x00, 0x40, 0x42, 0x0f, 0x00, 0x00, 0x00,
+    0xf7, 0x08, 0x4a, 0xa3, 0x26, 0x05, 0x00, 0x00, 0x00, 0x00, 0xdc, 0x05,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x63, 0x00, 0x00, 0x00, 0x42, 0xda};
+
+static const char *const kRmc =
+    "$GPRMC,120000.00,A,5231.20000,N,01324.30000,E,0.0,,010124,,,A*75\r\n";
+// The receiver's output before a fix. The date is plausible, but comes
+// from its own clock: none of it may be taken as the time.
+static const char *const kNoFix[] = {
+    "$GPRMC,120000.00,V,,,,,,,010124,,,N*78\r\n",
+    "$GPZDA,120000.00,01,01,2024,00,00*61\r\n",
+    "$GPGGA,120000.00,,,,,0,00,99.99,,,,,,*65\r\n",
+    "$GPGLL,,,,,120000.00,V,N*49\r\n",
+};
+
+// What the receiver does with the next CFG command
+enum class Answer {
+  kAck,
+  kNak,
+  kSilent,
+  kBadChecksum,   // ACK-ACK with a broken checksum
+  kOversizeFirst, // a frame too long for the parser, then ACK-ACK
+  kOtherAckFirst, // ACK-ACK of another message, then the right one
+};
+
+static PersistentState state = {};
+PersistentState persistent_state_get() { return state; }
+
+static std::vector<Bytes> received;
+static std::deque<Answer> script;
+static UbxParser receiver_parser;
+
+// The reader task's side
+static QueueHandle_t uart_events = nullptr;
+static GpsReader *reader = nullptr;
+static int sentences = 0;
+static int sentences_sent = 0;
+
+static int failures = 0;
+
+static void expect(bool ok, const char *what) {
+  if (!ok) {
+    printf("FAILED: %s\n", what);
+    failures++;
+  }
+}
+
+// The receiver sends `bytes`, the reader task handles the events for them
+static void deliver(const Bytes &bytes) {
+  host_uart_rx(bytes.data(), bytes.size());
+  uart_event_t event;
+  while (xQueueReceive(uart_events, &event, 0) == pdTRUE) {
+    reader->on_event(event, kGpsDefaultBaudRate, esp_timer_get_time(), 0);
+  }
+}
+
+static Bytes operator+(Bytes a, const Bytes &b) {
+  a.insert(a.end(), b.begin(), b.end());
+  return a;
+}
+
+static Bytes frame(uint8_t cls, uint8_t id, const Bytes &payload) {
+  Bytes out(payload.size() + kUbxFrameOverhead);
+  ubx_frame(cls, id, payload.data(), payload.size(), out.data());
+  return out;
+}
+
+static Bytes ack(uint8_t id, uint8_t cls, uint8_t acked_id) {
+  return frame(kUbxClassAck, id, {cls, acked_id});
+}
+
+static void answer(uint8_t cls, uint8_t id) {
+  const Answer what = script.empty() ? Answer::kAck : script.front();
+  if (!script.empty()) {
+    script.pop_front();
+  }
+  Bytes out(kRmc, kRmc + strlen(kRmc));
+  sentences_sent++;
+  switch (what) {
+  case Answer::kAck:
+    out = out + ack(kUbxIdAckAck, cls, id);
+    break;
+  case Answer::kNak:
+    out = out + ack(kUbxIdAckNak, cls, id);
+    break;
+  case Answer::kSilent:
+    break;
+  case Answer::kBadChecksum: {
+    Bytes bad = ack(kUbxIdAckAck, cls, id);
+    bad.back() ^= 0x01;
+    out = out + bad;
+    break;
+  }
+  case Answer::kOversizeFirst:
+    out = out + frame(kUbxClassNav, 0x30, Bytes(kUbxMaxPayload + 1, 0x11)) +
+          ack(kUbxIdAckAck, cls, id);
+    break;
+  case Answer::kOtherAckFirst:
+    out = out + ack(kUbxIdAckAck, cls, id + 1) + ack(kUbxIdAckAck, cls, id);
+    break;
+  }
+  // The next line is a measurement period away, the answer has to get
+  // through without its '\n'
+  deliver(out);
+}
+
+// host_uart_tx: collect frames, answer CFG commands like the receiver
+static void receive(const uint8_t *data, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    if (!receiver_parser.feed(data[i])) {
+      continue;
+    }
+    // The parser checked the checksum, framing it again gives the bytes
+    const UbxFrame &f = receiver_parser.frame();
+    received.push_back(
+        frame(f.cls, f.id, Bytes(f.payload, f.payload + f.length)));
+    if (f.cls == kUbxClassCfg) {
+      answer(f.cls, f.id);
+    }
+  }
+}
+
+static esp_err_t send_rate(const char *what, Answer reply) {
+  script = {reply};
+  uint8_t payload[kUbxCfgRateLength];
+  ubx_cfg_rate(1000, payload);
+  const TickType_t start = xTaskGetTickCount();
+  const esp_err_t err = gps_control_send(kUbxClassCfg, kUbxIdCfgRate,
+                                         payload, sizeof(payload), true);
+  const TickType_t waited = xTaskGetTickCount() - start;
+  const char *result = err == ESP_OK     ? "ACK"
+                       : err == ESP_FAIL ? "NAK"
+                                         : "timeout";
+  printf("%-36s %-7s after %lu ms\n", what, result,
+         static_cast<unsigned long>(waited * portTICK_PERIOD_MS));
+  return err;
+}
+
+static void test_acks() {
+  expect(send_rate("ACK", Answer::kAck) == ESP_OK, "ACK");
+  expect(send_rate("NAK", Answer::kNak) == ESP_FAIL, "NAK");
+
+  const TickType_t start = xTaskGetTickCount();
+  expect(send_rate("no answer", Answer::kSilent) == ESP_ERR_TIMEOUT,
+         "no answer times out");
+  expect(xTaskGetTickCount() - start >= pdMS_TO_TICKS(kUbxAckTimeoutMs),
+         "timeout waits kUbxAckTimeoutMs");
+
+  const uint32_t checksum_errors = reader->checksum_errors();
+  expect(send_rate("ACK with a bad checksum", Answer::kBadChecksum) ==
+             ESP_ERR_TIMEOUT,
+         "bad checksum ACK is dropped");
+  expect(reader->checksum_errors() == checksum_errors + 1,
+         "bad checksum is counted");
+
+  expect(send_rate("oversize frame, then ACK", Answer::kOversizeFirst) ==
+             ESP_OK,
+         "parser resyncs after an oversize frame");
+  expect(send_rate("ACK of another message, then ACK",
+                   Answer::kOtherAckFirst) == ESP_OK,
+         "ACKs are matched by class and id");
+
+  // An ACK nobody waited for must not answer the next command
+  deliver(ack(kUbxIdAckAck, kUbxClassCfg, kUbxIdCfgRate));
+  expect(send_rate("stale ACK, no answer", Answer::kSilent) ==
+             ESP_ERR_TIMEOUT,
+         "stale ACK is flushed before sending");
+}
+
+static void test_frames() {
+  received.clear();
+  expect(gps_control_enter_backup() == ESP_OK, "RXM-PMREQ sent");
+  expect(received.size() == 1 && received[0] == kRxmPmreqBackup,
+         "RXM-PMREQ backup frame");
+
+  received.clear();
+  uint8_t prt[kUbxCfgPrtLength];
+  ubx_cfg_prt_uart(38400, prt);
+  gps_control_send(kUbxClassCfg, kUbxIdCfgPrt, prt, sizeof(prt), false);
+  expect(!received.empty() && received[0] == kCfgPrt38400,
+         "CFG-PRT 8N1 frame");
+
+  received.clear();
+  GpsAiding aiding = {};
+  aiding.position_valid = true;
+  aiding.latitude_e7 = 525200000;
+  aiding.longitude_e7 = 134050000;
+  aiding.position_accuracy_cm = kGpsAidPositionAccuracyCm;
+  aiding.time_valid = true;
+  aiding.utc_us = utc_seconds(2024, 1, 1, 0, 0, 0) * 1000000 + 250000;
+  aiding.time_accuracy_ms = 1500;
+  uint8_t ini[kUbxAidIniLength];
+  ubx_aid_ini(aiding, ini);
+  gps_control_send(kUbxClassAid, kUbxIdAidIni, ini, sizeof(ini), false);
+  expect(received.size() == 1 && received[0] == kAidIni, "AID-INI frame");
+
+  // The same through gps_control_send_aiding(), at the host's time
+  received.clear();
+  state.position = {1, 525200000, 134050000};
+  timeval now;
+  gettimeofday(&now, NULL);
+  state.drift.anchor_time_us = now.tv_sec * 1000000LL - 3600 * 1000000LL;
+  state.drift.uncertainty_ppb = 20000;
+  expect(gps_control_send_aiding() == ESP_OK, "aiding sent");
+  expect(received.size() == 1 && received[0].size() == kAidIni.size(),
+         "aiding is one AID-INI");
+  if (received.size() == 1 && received[0].size() == kAidIni.size()) {
+    const uint8_t *p = received[0].data() + 6;
+    const int64_t gps_ms = ubx_get_u16(p + 18) * kGpsWeekS * 1000 +
+                           ubx_get_u32(p + 20);
+    const int64_t utc_ms =
+        gps_ms + (kGpsEpochUnix - kGpsUtcLeapSeconds) * 1000;
+    expect(llabs(utc_ms - now.tv_sec * 1000LL) < 1000,
+           "aiding week and TOW are the host's time");
+    // An hour at 20 ppm, on top of the sync error
+    expect(ubx_get_u32(p + 28) == (72000 + kDriftSyncErrorUs) / 1000,
+           "aiding time accuracy");
+    expect(ubx_get_u32(p + 44) == 0x63, "aiding flags");
+  }
+
+  // Without time and position there is nothing to tell
+  received.clear();
+  state = {};
+  expect(gps_control_send_aiding() == ESP_OK && received.empty(),
+         "no aiding without a position or time");
+}
+
+static void test_configure() {
+  received.clear();
+  script.clear();
+  expect(gps_control_configure() == ESP_OK, "configure");
+  // 7 NMEA sentences, NAV-TIMEUTC and CFG-RATE
+  expect(received.size() == 9, "configure sends 9 commands");
+  expect(!received.empty() && received[0] == kCfgMsgGgaOff,
+         "CFG-MSG GGA off frame");
+  // RMC brings the fix, ZDA has no way to say whether its time is any good
+  int rmc_rate = -1;
+  int zda_rate = -1;
+  for (const Bytes &f : received) {
+    if (f[2] == kUbxClassCfg && f[3] == kUbxIdCfgMsg &&
+        f[6] == kUbxClassNmea) {
+      if (f[7] == kUbxIdNmeaRmc) {
+        rmc_rate = f[8];
+      } else if (f[7] == kUbxIdNmeaZda) {
+        zda_rate = f[8];
+      }
+    }
+  }
+  expect(rmc_rate == 1, "RMC on");
+  expect(zda_rate == 0, "ZDA off");
+
+  received.clear();
+  script = {Answer::kAck, Answer::kAck, Answer::kNak};
+  expect(gps_control_configure() == ESP_FAIL, "configure reports the NAK");
+  expect(received.size() == 3, "configure stops at the NAK");
+}
+
+static void test_no_fix() {
+  const int64_t local_us = utc_seconds(2024, 1, 1, 11, 0, 0) * 1000000;
+  for (const char *line : kNoFix) {
+    NmeaParser parser;
+    bool parsed = false;
+    bool taken = false;
+    for (const char *p = line; *p != '\0'; p++) {
+      if (parser.feed(*p)) {
+        parsed = true;
+        const auto reading = nmea_read_time(parser.sentence());
+        taken = reading && nmea_reading_utc_us(*reading, local_us, true);
+      }
+    }
+    expect(parsed && !taken, "no time without a fix");
+  }
+}
+
+static void test_coordinates() {
+  int32_t degrees_e7 = 0;
+  expect(nmea_parse_coordinate("5231.20000", "N", degrees_e7) &&
+             degrees_e7 == 525200000,
+         "coordinate parsed");
+  expect(nmea_parse_coordinate("01359.99999", "W", degrees_e7) &&
+             degrees_e7 == -139999998,
+         "western coordinate parsed");
+  expect(!nmea_parse_coordinate("5260.00000", "N", degrees_e7),
+         "60 minutes rejected");
+  expect(!nmea_parse_coordinate("01399.5", "E", degrees_e7),
+         "99 minutes rejected");
+}
+
+int main() {
+  host_uart_tx = receive;
+  uart_events = xQueueCreate(32, sizeof(uart_event_t));
+  host_uart_events = uart_events;
+  GpsReaderSink sink;
+  sink.sentence = [](const NmeaSentence &, const GpsEpochTiming &) {
+    sentences++;
+    return false;
+  };
+  sink.frame = [](const UbxFrame &f, const GpsEpochTiming &) {
+    gps_control_on_frame(f);
+    return false;
+  };
+  GpsReader gps_reader(UART_NUM_1, uart_events, 16, sink);
+  reader = &gps_reader;
+  gps_control_init();
+
+  test_frames();
+  test_acks();
+  test_configure();
+  test_no_fix();
+  test_coordinates();
+
+  // The line after the last answer
+  deliver(Bytes(kRmc, kRmc + strlen(kRmc)));
+  sentences_sent++;
+  expect(sentences == sentences_sent, "NMEA around the UBX answers intact");
+  printf("%d sentences, %lu checksum errors, %d failures\n", sentences,
+         static_cast<unsigned long>(reader->checksum_errors()), failures);
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Open circuit voltage of a typical 18650 at room temperature, by state of
+// charge in permille
+struct OcvPoint {
+  uint16_t mv;
+  uint16_t soc_permille;
+};
+static constexpr OcvPoint kOcvCurve[] = {
+    {3000, 0},   {3300, 20},  {3450, 50},  {3550, 100}, {3630, 200},
+    {3690, 300}, {3740, 400}, {3790, 500}, {3850, 600}, {3920, 700},
+    {4000, 800}, {4080, 900}, {4200, 1000},
+};
+
+// The cell is measured while the CPU is awake. Add back the drop across its
+// internal resistance to get an open circuit voltage.
+static constexpr uint32_t kAwakeCurrentMa = 40;
+static constexpr uint32_t kCellResistanceMohm = 150;
+static constexpr uint32_t kLoadCorrectionMv =
+    kAwakeCurrentMa * kCellResistanceMohm / 1000;
+
+// Below this the cell is in danger no matter what the curve says
+static constexpr uint32_t kCellCutoffMv = 3000;
+
+// The trend is updated at most this often, shorter spans are just noise
+static constexpr int64_t kTrendMinSpanS = 6 * 3600;
+
+enum class PowerTier : uint8_t {
+  kNormal,
+  kSaver,    // dimmer, fewer wakes, GPS resyncs stretched
+  kCritical, // minimum brightness, rare wakes, GPS resyncs stretched further
+  kShutdown, // deep sleep with backoff until the cell is charged
+  kCount,
+};
+
+struct PowerPolicy {
+  const char *name;
+  uint16_t enter_below_permille; // switch to this tier below this charge
+  uint16_t exit_above_permille;  // and back up only above this one
+  uint32_t max_light_scale;      // Q8 cap for LedTime::light_scale
+  uint32_t min_wake_interval_s;
+  uint32_t max_wake_interval_s;
+  uint32_t resync_interval_factor; // stretches drift-model resync intervals
+};
+
+static constexpr PowerPolicy
+    kPowerPolicies[static_cast<size_t>(PowerTier::kCount)] = {
+        {"normal", 1000, 0, 256, 60, 10 * 60, 1},
+        {"saver", 300, 330, 160, 2 * 60, 20 * 60, 2},
+        {"critical", 150, 180, 64, 5 * 60, 30 * 60, 8},
+        {"shutdown", 50, 80, 0, 0, 0, 0},
+};
+
+// Deep sleep wake interval in the shutdown tier, doubling on every wake
+// that finds the cell still empty
+static constexpr uint32_t kShutdownBaseSleepS = 100;
+static constexpr uint32_t kShutdownMaxSleepS = 6 * 3600;
+
+struct BatteryEstimate {
+  int64_t trend_reference_time; // UTC seconds
+  int32_t trend_reference_permille;
+  int32_t soc_permille;
+  int32_t trend_permille_per_day; // negative while discharging
+  PowerTier tier;
+  uint8_t shutdown_wakes; // consecutive wakes that stayed in shutdown
+  bool valid;
+};
+
+inline int32_t ocv_to_soc_permille(uint32_t mv) {
+  constexpr size_t kPoints = sizeof(kOcvCurve) / sizeof(kOcvCurve[0]);
+  if (mv <= kOcvCurve[0].mv) {
+    return kOcvCurve[0].soc_permille;
+  }
+  for (size_t i = 1; i < kPoints; i++) {
+    if (mv <= kOcvCurve[i].mv) {
+      const OcvPoint &lo = kOcvCurve[i - 1];
+      const OcvPoint &hi = kOcvCurve[i];
+      return lo.soc_permille + static_cast<int32_t>(mv - lo.mv) *
+                                   (hi.soc_permille - lo.soc_permille) /
+                                   (hi.mv - lo.mv);
+    }
+  }
+  return kOcvCurve[kPoints - 1].soc_permille;
+}
+
+// Inverse of ocv_to_soc_permille()
+inline uint32_t soc_permille_to_ocv(int32_t soc_permille) {
+  constexpr size_t kPoints = sizeof(kOcvCurve) / sizeof(kOcvCurve[0]);
+  if (soc_permille <= kOcvCurve[0].soc_permille) {
+    return kOcvCurve[0].mv;
+  }
+  for (size_t i = 1; i < kPoints; i++) {
+    if (soc_permille <= kOcvCurve[i].soc_permille) {
+      const OcvPoint &lo = kOcvCurve[i - 1];
+      const OcvPoint &hi = kOcvCurve[i];
+      return lo.mv + (soc_permille - lo.soc_permille) * (hi.mv - lo.mv) /
+                         (hi.soc_permille - lo.soc_permille);
+    }
+  }
+  return kOcvCurve[kPoints - 1].mv;
+}
+
+inline PowerTier select_power_tier(PowerTier current, int32_t soc_permille,
+                                   uint32_t cell_mv) {
+  if (cell_mv < kCellCutoffMv) {
+    return PowerTier::kShutdown;
+  }
+  // Go down as far as the charge says, but only climb a tier once its exit
+  // threshold is cleared
+  size_t tier = static_cast<size_t>(current);
+  while (tier + 1 < static_cast<size_t>(PowerTier::kCount) &&
+         soc_permille < kPowerPolicies[tier + 1].enter_below_permille) {
+    tier++;
+  }
+  while (tier > 0 && soc_permille > kPowerPolicies[tier].exit_above_permille) {
+    tier--;
+  }
+  return static_cast<PowerTier>(tier);
+}
+
+// Feeds a filtered reading of the cell taken while awake
+inline void battery_update(BatteryEstimate &estimate, uint32_t loaded_mv,
+                           int64_t now) {
+  const uint32_t cell_mv = loaded_mv + kLoadCorrectionMv;
+  estimate.soc_permille = ocv_to_soc_permille(cell_mv);
+
+  if (!estimate.valid) {
+    estimate.trend_reference_time = now;
+    estimate.trend_reference_permille = estimate.soc_permille;
+    estimate.trend_permille_per_day = 0;
+    estimate.tier = PowerTier::kNormal;
+    estimate.valid = true;
+  }
+
+  const int64_t span_s = now - estimate.trend_reference_time;
+  if (span_s >= kTrendMinSpanS) {
+    const int32_t rate = static_cast<int32_t>(
+        (estimate.soc_permille - estimate.trend_reference_permille) * 86400LL /
+        span_s);
+    estimate.trend_permille_per_day =
+        (3 * estimate.trend_permille_per_day + rate) / 4;
+    estimate.trend_reference_time = now;
+    estimate.trend_reference_permille = estimate.soc_permille;
+  } else if (span_s < 0) {
+    // Clock was set, restart the trend window
+    estimate.trend_reference_time = now;
+  }
+
+  estimate.tier = select_power_tier(estimate.tier, estimate.soc_permille,
+                                    cell_mv);
+  if (estimate.tier != PowerTier::kShutdown) {
+    estimate.shutdown_wakes = 0;
+  }
+}
+
+// Deep sleep time for the next shutdown wake, backing off exponentially
+inline uint32_t shutdown_sleep_s(uint8_t shutdown_wakes) {
+  uint32_t sleep_s = kShutdownBaseSleepS;
+  for (uint8_t i = 0; i < shutdown_wakes && sleep_s < kShutdownMaxSleepS;
+       i++) {
+    sleep_s *= 2;
+  }
+  return sleep_s < kShutdownMaxSleepS ? sleep_s : kShutdownMaxSleepS;
+}
+
+inline const PowerPolicy &power_policy(PowerTier tier) {
+  return kPowerPolicies[static_cast<size_t>(tier)];
+}
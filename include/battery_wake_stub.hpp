@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+
+#include "driver/adc.h"
+
+// Hands the shutdown tier over to a deep sleep wake stub. The stub runs from
+// RTC memory before the bootloader, reads `channel` and goes straight back
+// to sleep, doubling the interval, until the reading is above
+// `resume_adc_mv`. Only then does the application boot again.
+// Call right before esp_deep_sleep_start(), after init_adc() on `channel`.
+void battery_wake_stub_arm(adc1_channel_t channel, uint32_t resume_adc_mv,
+                           uint32_t sleep_s);
+
+// Disarms the stub and returns how many wakes it handled on its own since
+// it was armed
+uint32_t battery_wake_stub_disarm();
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+
+static constexpr int64_t kSecondsPerDay = 24 * 3600;
+
+// Days since 1970-01-01 of a proleptic Gregorian date, month 1-12. Unlike
+// mktime() this doesn't depend on TZ.
+inline int64_t days_from_civil(int32_t year, int32_t month, int32_t day) {
+  year -= month <= 2;
+  const int64_t era = (year >= 0 ? year : year - 399) / 400;
+  const int64_t year_of_era = year - era * 400;
+  const int64_t day_of_year =
+      (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  const int64_t day_of_era = year_of_era * 365 + year_of_era / 4 -
+                             year_of_era / 100 + day_of_year;
+  return era * 146097 + day_of_era - 719468;
+}
+
+// UTC seconds since the epoch
+inline int64_t utc_seconds(int32_t year, int32_t month, int32_t day,
+                           int32_t hour, int32_t minute, int32_t second) {
+  return days_from_civil(year, month, day) * kSecondsPerDay + hour * 3600 +
+         minute * 60 + second;
+}
+
+// Inverse of days_from_civil()
+inline void civil_from_days(int64_t days, int32_t &year, int32_t &month,
+                            int32_t &day) {
+  days += 719468;
+  const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+  const int64_t day_of_era = days - era * 146097;
+  const int64_t year_of_era = (day_of_era - day_of_era / 1460 +
+                               day_of_era / 36524 - day_of_era / 146096) /
+                              365;
+  const int64_t day_of_year = day_of_era - (365 * year_of_era +
+                                            year_of_era / 4 -
+                                            year_of_era / 100);
+  const int64_t mp = (5 * day_of_year + 2) / 153;
+  day = static_cast<int32_t>(day_of_year - (153 * mp + 2) / 5 + 1);
+  month = static_cast<int32_t>(mp < 10 ? mp + 3 : mp - 9);
+  year = static_cast<int32_t>(year_of_era + era * 400 + (month <= 2));
+}
+
+inline bool is_leap_year(int32_t year) {
+  return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+inline int32_t days_in_month(int32_t year, int32_t month) {
+  static constexpr int8_t kDays[] = {31, 28, 31, 30, 31, 30,
+                                     31, 31, 30, 31, 30, 31};
+  return kDays[month - 1] + (month == 2 && is_leap_year(year));
+}
+
+// Fills `out` from seconds since the epoch, without any TZ. tm_isdst is
+// left to the caller.
+inline void civil_breakdown(int64_t seconds, tm &out) {
+  int64_t days = seconds / kSecondsPerDay;
+  int64_t second_of_day = seconds % kSecondsPerDay;
+  if (second_of_day < 0) {
+    days--;
+    second_of_day += kSecondsPerDay;
+  }
+  int32_t year;
+  int32_t month;
+  int32_t day;
+  civil_from_days(days, year, month, day);
+  out.tm_year = year - 1900;
+  out.tm_mon = month - 1;
+  out.tm_mday = day;
+  out.tm_hour = static_cast<int>(second_of_day / 3600);
+  out.tm_min = static_cast<int>(second_of_day / 60 % 60);
+  out.tm_sec = static_cast<int>(second_of_day % 60);
+  // 1970-01-01 was a Thursday
+  out.tm_wday = static_cast<int>(((days + 4) % 7 + 7) % 7);
+  out.tm_yday = static_cast<int>(days - days_from_civil(year, 1, 1));
+}
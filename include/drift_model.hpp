@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+
+// Worst-case clock error we are willing to show before resyncing
+static constexpr int64_t kDriftTargetErrorUs = 30 * 1000000LL;
+// The RC slow clock of an unknown unit: assume it's bad until measured
+static constexpr int32_t kDriftDefaultUncertaintyPpb = 500000;
+static constexpr int32_t kDriftMinUncertaintyPpb = 2000;
+// Anything beyond this is not drift but a clock that was never set
+static constexpr int32_t kDriftMaxPpb = 2000000;
+// Syncs closer together than this are too noisy to measure drift
+static constexpr int64_t kDriftMinSampleSpanUs = 6 * 3600 * 1000000LL;
+// Error of a single sync. Sentence timing puts it within the receiver's
+// output latency jitter, a PPS edge does much better.
+static constexpr int64_t kDriftSyncErrorUs = 100 * 1000;
+static constexpr int64_t kDriftMinResyncIntervalS = 6 * 3600;
+static constexpr int64_t kDriftMaxResyncIntervalS = 60 * 24 * 3600;
+
+// Linear model of the local oscillator, measured between consecutive GPS
+// syncs. The correction is applied continuously, so every new sync measures
+// the residual error of the current estimate.
+struct DriftModel {
+  int64_t anchor_time_us;     // UTC of the last sync, 0 if never synced
+  int64_t last_correction_us; // local clock when last corrected
+  int32_t drift_ppb;          // positive: local clock runs fast
+  int32_t uncertainty_ppb;
+  int32_t correction_remainder; // sub-microsecond part, in us * 1e-9
+  uint16_t samples;
+};
+
+// Feeds a GPS sync into the model. `local_us` is the system clock right
+// before it gets set to `gps_us`.
+inline void drift_model_on_sync(DriftModel &model, int64_t local_us,
+                                int64_t gps_us) {
+  if (model.uncertainty_ppb == 0) {
+    model.uncertainty_ppb = kDriftDefaultUncertaintyPpb;
+  }
+
+  const int64_t span_us = gps_us - model.anchor_time_us;
+  if (model.anchor_time_us != 0 && span_us >= kDriftMinSampleSpanUs) {
+    const int64_t offset_us = local_us - gps_us;
+    const int64_t residual_ppb = offset_us * 1000000000LL / span_us;
+    if (std::llabs(residual_ppb) < kDriftMaxPpb) {
+      const int32_t residual = static_cast<int32_t>(residual_ppb);
+      const int32_t noise_ppb =
+          static_cast<int32_t>(kDriftSyncErrorUs * 1000000000LL / span_us);
+      int32_t uncertainty;
+      if (model.samples == 0) {
+        model.drift_ppb = residual;
+        uncertainty = std::abs(residual) / 4 + noise_ppb;
+      } else {
+        // The residual is how wrong the last estimate was, half of it is
+        // taken as correction, its size feeds the uncertainty
+        model.drift_ppb += residual / 2;
+        uncertainty =
+            (3 * model.uncertainty_ppb + std::abs(residual)) / 4 + noise_ppb;
+      }
+      model.uncertainty_ppb =
+          uncertainty < kDriftMinUncertaintyPpb ? kDriftMinUncertaintyPpb
+                                                : uncertainty;
+      model.samples++;
+    }
+  }
+
+  model.anchor_time_us = gps_us;
+  model.last_correction_us = gps_us;
+  model.correction_remainder = 0;
+}
+
+// Returns how many microseconds the local clock gained since the last call
+// and advances the model's bookkeeping to the corrected clock.
+inline int64_t drift_model_take_correction(DriftModel &model,
+                                           int64_t local_us) {
+  const int64_t elapsed_us = local_us - model.last_correction_us;
+  if (model.samples == 0 || elapsed_us <= 0) {
+    model.last_correction_us = local_us;
+    return 0;
+  }
+
+  const int64_t scaled =
+      elapsed_us * model.drift_ppb + model.correction_remainder;
+  const int64_t correction_us = scaled / 1000000000LL;
+  model.correction_remainder = static_cast<int32_t>(scaled % 1000000000LL);
+  model.last_correction_us = local_us - correction_us;
+  return correction_us;
+}
+
+// How far the corrected clock may be off at `utc_us`: the error of the
+// last sync, plus what the oscillator may have drifted since. 0 if never
+// synced.
+inline int64_t drift_model_expected_error_us(const DriftModel &model,
+                                             int64_t utc_us) {
+  if (model.anchor_time_us == 0) {
+    return 0;
+  }
+  const int32_t uncertainty_ppb = model.uncertainty_ppb > 0
+                                      ? model.uncertainty_ppb
+                                      : kDriftDefaultUncertaintyPpb;
+  const int64_t since_ms = std::llabs(utc_us - model.anchor_time_us) / 1000;
+  return since_ms * uncertainty_ppb / 1000000 + kDriftSyncErrorUs;
+}
+
+// UTC seconds at which the expected error reaches kDriftTargetErrorUs.
+// Returns 0 (due immediately) if we were never synced.
+inline int64_t drift_model_next_resync(const DriftModel &model) {
+  if (model.anchor_time_us == 0) {
+    return 0;
+  }
+  const int32_t uncertainty_ppb = model.uncertainty_ppb > 0
+                                      ? model.uncertainty_ppb
+                                      : kDriftDefaultUncertaintyPpb;
+  int64_t interval_s = kDriftTargetErrorUs * 1000 / uncertainty_ppb;
+  if (interval_s < kDriftMinResyncIntervalS)
+    interval_s = kDriftMinResyncIntervalS;
+  if (interval_s > kDriftMaxResyncIntervalS)
+    interval_s = kDriftMaxResyncIntervalS;
+  return model.anchor_time_us / 1000000 + interval_s;
+}
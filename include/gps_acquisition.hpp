@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+
+#include <freertos/FreeRTOS.h>
+
+// Lifecycle of one GPS session
+enum class GpsState : uint8_t {
+  kOff,       // receiver unpowered or in backup, no UART driver, no task
+  kPowering,  // powered, waiting for the first complete sentence
+  kAcquiring, // sentences arrive, none carried a usable time yet
+  kSynced,    // the clock was set from the receiver
+  kFailed,    // gave up: timeout, or the UART couldn't be set up
+};
+
+// Sets up the power pin and switches the receiver off. Call once at boot.
+void gps_acquisition_init();
+
+// Powers the receiver, installs the UART driver and starts the reader task.
+// Does nothing if a session is already running.
+void gps_acquisition_start();
+
+// Blocks the caller until the session synced the clock or `timeout` ticks
+// passed, whichever comes first. A timeout marks the session failed. Once
+// the receiver talks, it gets configured and aided from here.
+GpsState gps_acquisition_wait(TickType_t timeout);
+
+// Stops the reader task and uninstalls the UART driver. The receiver goes
+// into backup with `backup` (and kGpsUseBackupMode), otherwise its supply
+// is cut.
+void gps_acquisition_stop(bool backup = true);
+
+// One bounded attempt: start, wait for a sync within the attempt budget
+// (see gps_backoff.hpp), stop. The outcome goes into the persistent GPS
+// stats, and a failure schedules the next attempt on the backoff. `cold`
+// is for a receiver that never delivered a time.
+GpsState gps_acquisition_attempt(bool cold);
+
+GpsState gps_acquisition_state();
+
+const char *gps_state_name(GpsState state);
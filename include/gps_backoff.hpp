@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+
+// Receiver plus antenna while tracking, what an attempt costs per second
+static constexpr uint32_t kGpsActiveCurrentMa = 25;
+// Charge one attempt may spend. A cold receiver has to find satellites
+// without any almanac, a warm one only has to pick up the time again.
+static constexpr uint32_t kGpsColdAttemptBudgetMas = kGpsActiveCurrentMa * 300;
+static constexpr uint32_t kGpsWarmAttemptBudgetMas = kGpsActiveCurrentMa * 120;
+
+// Retry delay after the first failed attempt, doubling with every further
+// failure in a row
+static constexpr int64_t kGpsBackoffBaseS = 15 * 60;
+static constexpr int64_t kGpsBackoffMaxS = 24 * 3600;
+
+// Outcome of GPS attempts since first boot, kept in the persistent state.
+// A unit with many failures or long times to fix is badly placed.
+struct GpsAttemptStats {
+  int64_t next_attempt_time; // UTC seconds, 0 for right away
+  uint32_t attempts;
+  uint32_t failures;
+  uint32_t on_time_s; // total receiver on time
+  uint32_t ttf_sum_s; // time to fix, summed over successful attempts
+  uint16_t last_ttf_s;
+  uint16_t max_ttf_s;
+  uint16_t consecutive_failures;
+};
+
+inline uint32_t gps_attempt_budget_ms(bool cold) {
+  const uint32_t budget_mas =
+      cold ? kGpsColdAttemptBudgetMas : kGpsWarmAttemptBudgetMas;
+  return budget_mas / kGpsActiveCurrentMa * 1000;
+}
+
+// Whether the backoff allows an attempt at `now`. A retry time further out
+// than the longest backoff means the clock was set since, ignore it.
+inline bool gps_attempt_due(const GpsAttemptStats &stats, int64_t now) {
+  return now >= stats.next_attempt_time ||
+         stats.next_attempt_time - now > kGpsBackoffMaxS;
+}
+
+inline void gps_attempt_on_success(GpsAttemptStats &stats, uint32_t ttf_s) {
+  const uint16_t ttf = ttf_s > UINT16_MAX ? UINT16_MAX : ttf_s;
+  stats.attempts++;
+  stats.on_time_s += ttf_s;
+  stats.ttf_sum_s += ttf_s;
+  stats.last_ttf_s = ttf;
+  if (ttf > stats.max_ttf_s) {
+    stats.max_ttf_s = ttf;
+  }
+  stats.consecutive_failures = 0;
+  stats.next_attempt_time = 0;
+}
+
+inline void gps_attempt_on_failure(GpsAttemptStats &stats, uint32_t on_s,
+                                   int64_t now) {
+  stats.attempts++;
+  stats.failures++;
+  stats.on_time_s += on_s;
+  if (stats.consecutive_failures < UINT16_MAX) {
+    stats.consecutive_failures++;
+  }
+  int64_t delay_s = kGpsBackoffBaseS;
+  for (uint16_t i = 1;
+       i < stats.consecutive_failures && delay_s < kGpsBackoffMaxS; i++) {
+    delay_s *= 2;
+  }
+  stats.next_attempt_time =
+      now + (delay_s < kGpsBackoffMaxS ? delay_s : kGpsBackoffMaxS);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+
+#include "esp_err.h"
+#include "ubx.hpp"
+
+// Put the receiver into backup instead of cutting its supply. It keeps
+// almanac, ephemeris and its RTC for a hot start at ~20 uA.
+static constexpr bool kGpsUseBackupMode = true;
+
+// The receiver's baud rate out of a power cut
+static constexpr uint32_t kGpsDefaultBaudRate = 9600;
+// Rate gps_control_configure() switches to, 0 to stay at the default. A
+// faster rate gets each burst of sentences over sooner; 38400 is still an
+// exact enough division of the 1 MHz REF_TICK the UART runs from.
+static constexpr uint32_t kGpsFastBaudRate = 0;
+// The firmware only wants the time, a solution every 2 s is plenty
+static constexpr uint16_t kGpsMeasurementRateMs = 2000;
+// Take the time as soon as the receiver reports UTC valid (NAV-TIMEUTC),
+// which usually comes well before a position fix. Otherwise, and as long
+// as no position is known for the timezone, only time from sentences with
+// a fix is taken.
+static constexpr bool kGpsTimeOnly = true;
+
+// How long gps_control_send() waits for an ACK-ACK or ACK-NAK. The
+// receiver may hold an answer back until its output for the measurement
+// is out.
+static constexpr uint32_t kUbxAckTimeoutMs = kGpsMeasurementRateMs + 500;
+// Position aiding accuracy: the last fix is a good guess, unless the clock
+// got carried somewhere else since
+static constexpr uint32_t kGpsAidPositionAccuracyCm = 10 * 1000 * 100;
+
+// Receiver commands over the GPS UART. All of these need the UART driver
+// installed, i.e. a running acquisition session.
+void gps_control_init();
+
+// Frames and sends a UBX message. With `wait_ack` waits for the receiver's
+// answer: ESP_OK on ACK-ACK, ESP_FAIL on ACK-NAK, ESP_ERR_TIMEOUT without
+// one. Must not be called from the reader task, which delivers the ACKs.
+esp_err_t gps_control_send(uint8_t cls, uint8_t id, const uint8_t *payload,
+                           uint16_t length, bool wait_ack);
+
+// Called by the reader task for every UBX frame that comes in
+void gps_control_on_frame(const UbxFrame &frame);
+
+// Turns off every NMEA sentence the firmware doesn't need, enables
+// NAV-TIMEUTC for kGpsTimeOnly, lowers the measurement rate and switches
+// to kGpsFastBaudRate if set. Run it once the
+// receiver talks. Returns the first error, the receiver may be left
+// partially configured. ESP_ERR_INVALID_STATE if it answers at neither baud
+// rate after the switch: only a power cut, and gps_control_on_power_cut(),
+// get both sides back to kGpsDefaultBaudRate.
+esp_err_t gps_control_configure();
+
+// Baud rate the receiver currently uses. It keeps configuration through
+// backup, but not through a power cut.
+uint32_t gps_control_baud_rate();
+void gps_control_on_power_cut();
+// Sets the UART to `baud_rate`, with pattern detection
+void gps_control_set_uart_baud_rate(uint32_t baud_rate);
+
+// Wakes the receiver from backup by toggling its RX line
+void gps_control_wake();
+
+// Sends the receiver into backup, returns once the command is out
+esp_err_t gps_control_enter_backup();
+
+// Hands the last known position and the drift corrected time to the
+// receiver, so it knows where to look for satellites
+esp_err_t gps_control_send_aiding();
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+#include "driver/uart.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "gps_timing.hpp"
+#include "nmea.hpp"
+#include "ubx.hpp"
+
+// Where the reader hands complete messages, with the timing of the epoch
+// they belong to. Both return whether the message set the clock.
+struct GpsReaderSink {
+  std::function<bool(const NmeaSentence &sentence,
+                     const GpsEpochTiming &timing)>
+      sentence;
+  std::function<bool(const UbxFrame &frame, const GpsEpochTiming &timing)>
+      frame;
+};
+
+// Moves the receiver's bytes out of the UART driver's ring buffer and
+// through both parsers, driven by the driver's events. Lines are timed by
+// the UART_PATTERN_DET of their '\n', and their sentences only handled
+// then. UBX frames carry no '\n': everything in front of the next one is
+// read on UART_DATA as well, so an ACK doesn't wait for the next line, and
+// navigation frames are timed by their own last byte. Neither counts
+// towards the length of the line after it.
+class GpsReader {
+public:
+  // `events` and `pattern_queue_length` as the driver was installed with
+  GpsReader(uart_port_t port, QueueHandle_t events, int pattern_queue_length,
+            GpsReaderSink sink)
+      : m_port(port), m_events(events),
+        m_pattern_queue_length(pattern_queue_length), m_sink(std::move(sink)) {
+  }
+
+  // Handles one event from the driver's queue, taken at `now_us` on the
+  // monotonic clock. `pps_us` is the latest PPS edge, 0 if none. Returns
+  // whether any of it set the clock.
+  bool on_event(const uart_event_t &event, uint32_t baud_rate,
+                int64_t now_us, int64_t pps_us) {
+    // Before looking for a '\n': whatever the ISR added since then comes
+    // with its position
+    size_t buffered = 0;
+    uart_get_buffered_data_len(m_port, &buffered);
+    switch (event.type) {
+    case UART_PATTERN_DET: {
+      const int pos = uart_pattern_pop_pos(m_port);
+      if (pos < 0) {
+        // Position queue overflowed, line boundaries are unknown
+        ESP_LOGW("UART", "Pattern queue full, dropping buffered data");
+        uart_flush_input(m_port);
+        return false;
+      }
+      // The interrupt fires kGpsPatternPostIdleBits after the '\n'
+      return read(pos + 1, buffered, baud_rate,
+                  now_us - kGpsPatternPostIdleBits * 1000000LL / baud_rate,
+                  pps_us);
+    }
+    case UART_DATA: {
+      // Up to, not including, a '\n' whose event is still queued
+      const int pos = uart_pattern_get_pos(m_port);
+      const int count = pos < 0 ? static_cast<int>(buffered)
+                                : std::min<int>(pos, buffered);
+      return read(count, buffered, baud_rate, now_us, pps_us);
+    }
+    case UART_FIFO_OVF:
+    case UART_BUFFER_FULL:
+      ESP_LOGW("UART", "RX overflow, dropping buffered data");
+      uart_flush_input(m_port);
+      uart_pattern_queue_reset(m_port, m_pattern_queue_length);
+      xQueueReset(m_events);
+      return false;
+    default:
+      return false;
+    }
+  }
+
+  // Sentences and frames dropped for a bad checksum
+  uint32_t checksum_errors() const {
+    return m_nmea.checksum_errors() + m_ubx.checksum_errors();
+  }
+
+private:
+  // Reads `count` bytes. `buffered` were in the ring buffer at `now_us`,
+  // the last of them just in: a byte is dated by the ones after it.
+  bool read(int count, size_t buffered, uint32_t baud_rate, int64_t now_us,
+            int64_t pps_us) {
+    const int newest = std::max<int>(count, buffered) - 1;
+    uint8_t chunk[128];
+    int done = 0;
+    bool synced = false;
+    while (done < count) {
+      const int len = uart_read_bytes(
+          m_port, chunk, std::min<int>(count - done, sizeof(chunk)), 0);
+      if (len <= 0) {
+        break;
+      }
+      ESP_LOGD("UART", "Received data: %.*s", len,
+               reinterpret_cast<const char *>(chunk));
+      for (int i = 0; i < len; i++) {
+        const int64_t arrived_us =
+            now_us - gps_uart_transfer_us(newest - (done + i), baud_rate);
+        if (feed(chunk[i], baud_rate, arrived_us, pps_us)) {
+          synced = true;
+        }
+      }
+      done += len;
+    }
+    return synced;
+  }
+
+  bool feed(uint8_t c, uint32_t baud_rate, int64_t arrived_us,
+            int64_t pps_us) {
+    bool synced = false;
+    // The bytes of a UBX frame, a '$' or '\n' among them, aren't text
+    if (!m_ubx.in_frame()) {
+      if (c == '$') {
+        // Starts the next sentence, the pending one is gone
+        m_sentence_pending = false;
+        m_line_bytes = 0;
+      }
+      if (m_nmea.feed(c)) {
+        m_sentence_pending = true;
+      }
+      m_line_bytes++;
+      if (c == '\n') {
+        m_timing.on_message(m_line_bytes, baud_rate, arrived_us, pps_us);
+        m_line_bytes = 0;
+        if (m_sentence_pending) {
+          m_sentence_pending = false;
+          synced = m_sink.sentence(m_nmea.sentence(), m_timing);
+        }
+      }
+    }
+    if (m_ubx.feed(c)) {
+      const UbxFrame &frame = m_ubx.frame();
+      // Answers to our commands come whenever, only navigation output
+      // belongs to an epoch
+      if (frame.cls == kUbxClassNav) {
+        m_timing.on_message(kUbxFrameOverhead + frame.length, baud_rate,
+                            arrived_us, pps_us);
+      }
+      if (m_sink.frame(frame, m_timing)) {
+        synced = true;
+      }
+    }
+    return synced;
+  }
+
+  uart_port_t m_port;
+  QueueHandle_t m_events;
+  int m_pattern_queue_length;
+  GpsReaderSink m_sink;
+
+  NmeaParser m_nmea;
+  UbxParser m_ubx;
+  GpsEpochTiming m_timing;
+  // Bytes of the current line so far, from its '$' on
+  int m_line_bytes = 0;
+  // A sentence is complete, its '\n' isn't in yet
+  bool m_sentence_pending = false;
+};
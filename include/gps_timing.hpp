@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+
+// From a navigation epoch to the first byte of its output. Only used
+// without PPS; about what u-blox receivers show at a 2 s measurement rate.
+static constexpr int64_t kGpsOutputLatencyUs = 60 * 1000;
+// A quiet line longer than this separates the output of two epochs. At
+// kGpsMeasurementRateMs the bursts are well over a second apart.
+static constexpr int64_t kGpsBurstGapUs = 200 * 1000;
+// Pattern detection settings of the UART, in bit periods. With a single
+// '\n' as pattern the gap between pattern characters doesn't matter. The
+// interrupt fires kGpsPatternPostIdleBits after the '\n' is in, none: the
+// line has to be read right away, not after the next line started.
+static constexpr int kGpsPatternGapBits = 9;
+static constexpr int kGpsPatternPostIdleBits = 0;
+
+// Time the receiver needs to send `bytes` in 8N1 at `baud_rate`
+inline int64_t gps_uart_transfer_us(int bytes, uint32_t baud_rate) {
+  return bytes * 10LL * 1000000 / baud_rate;
+}
+
+// Works out when the epoch a message belongs to was, on the monotonic clock
+// (esp_timer_get_time()). Each NMEA line or UBX frame gets timestamped when
+// its last byte came in, its start follows from its own length and the
+// baud rate. The first message after a quiet gap starts an epoch's output;
+// with a PPS edge less than a second before that, the edge is the epoch
+// itself.
+class GpsEpochTiming {
+public:
+  // A message of `bytes` bytes whose last byte came in at `end_us`.
+  // `pps_us` is the latest PPS edge, 0 if none.
+  void on_message(int bytes, uint32_t baud_rate, int64_t end_us,
+                  int64_t pps_us) {
+    const int64_t start_us = end_us - gps_uart_transfer_us(bytes, baud_rate);
+    if (m_last_end_us == 0 || start_us - m_last_end_us > kGpsBurstGapUs) {
+      m_burst_start_us = start_us;
+    }
+    m_last_end_us = end_us;
+
+    m_pps_locked = pps_us != 0 && pps_us <= m_burst_start_us &&
+                   m_burst_start_us - pps_us < 1000000;
+    m_epoch_us =
+        m_pps_locked ? pps_us : m_burst_start_us - kGpsOutputLatencyUs;
+  }
+
+  // Monotonic time of the last message's epoch
+  int64_t epoch_us() const { return m_epoch_us; }
+  // Whether that came from a PPS edge
+  bool pps_locked() const { return m_pps_locked; }
+
+private:
+  int64_t m_epoch_us = 0;
+  int64_t m_burst_start_us = 0;
+  int64_t m_last_end_us = 0;
+  bool m_pps_locked = false;
+};
+
+// The UTC at `now_us` on the monotonic clock, given the UTC of an epoch at
+// `epoch_mono_us`. A PPS edge marks the top of the second, the fraction
+// the receiver reports is its own estimate of the same instant.
+inline int64_t gps_utc_now_us(int64_t epoch_utc_us, int64_t epoch_mono_us,
+                              bool pps_locked, int64_t now_us) {
+  if (pps_locked) {
+    epoch_utc_us = (epoch_utc_us + 500000) / 1000000 * 1000000;
+  }
+  return epoch_utc_us + (now_us - epoch_mono_us);
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <driver/ledc.h>
+#include <esp_log.h>
+
+// A PWM timer setting. The RC fast clock runs at ~8 MHz, so duty resolution
+// and frequency trade against each other: 2^bits * freq_hz must stay below
+// that.
+struct PwmMode {
+  ledc_timer_bit_t resolution;
+  uint32_t freq_hz;
+  const char *name;
+};
+
+// Bright rooms: coarse steps are invisible at high duty, keep the flicker
+// frequency high
+static constexpr PwmMode kDaylightPwmMode{LEDC_TIMER_10_BIT, 1000, "daylight"};
+// Dark rooms: 16x finer duty steps so the bottom of the exponential curve
+// doesn't collapse onto a handful of values
+static constexpr PwmMode kNightPwmMode{LEDC_TIMER_14_BIT, 400, "night"};
+
+// Light scale (Q8, see LedTime::light_scale) thresholds with hysteresis, so
+// a reading hovering around the threshold doesn't toggle the timer
+static constexpr uint32_t kNightModeEnterScale = 64;
+static constexpr uint32_t kNightModeExitScale = 96;
+
+// Owns the LEDC timer all LED channels run on and maps normalized Q16
+// brightness to duty values at whatever resolution is currently active.
+class LedDimmer {
+public:
+  LedDimmer() : m_mode(&kDaylightPwmMode) { configure(kDaylightPwmMode); }
+
+  // The PWM mode for the given ambient light
+  const PwmMode &mode_for(uint32_t light_scale) const {
+    if (m_mode == &kDaylightPwmMode && light_scale < kNightModeEnterScale) {
+      return kNightPwmMode;
+    }
+    if (m_mode == &kNightPwmMode && light_scale > kNightModeExitScale) {
+      return kDaylightPwmMode;
+    }
+    return *m_mode;
+  }
+
+  // Reconfigures the timer. Duty values are relative to the resolution, so
+  // every channel needs a new duty afterwards, and running fades must be
+  // stopped before.
+  bool set_mode(const PwmMode &mode) {
+    return &mode != m_mode && configure(mode);
+  }
+
+  // frame: Q16 brightness, light_scale: Q8 ambient factor
+  uint32_t to_duty(uint32_t frame, uint32_t light_scale) const {
+    return (((frame * light_scale) >> 8) * max_duty()) >> 16;
+  }
+
+  uint32_t max_duty() const { return (1u << m_mode->resolution) - 1; }
+  const PwmMode &mode() const { return *m_mode; }
+
+private:
+  bool configure(const PwmMode &mode) {
+    ledc_timer_config_t ledc_timer = {
+        .speed_mode = LEDC_LOW_SPEED_MODE,
+        .duty_resolution = mode.resolution,
+        .timer_num = LEDC_TIMER_0,
+        .freq_hz = mode.freq_hz,
+        .clk_cfg =
+            LEDC_USE_RC_FAST_CLK, // LEDC_USE_RC_FAST_CLK survices light sleep
+    };
+    if (ledc_timer_config(&ledc_timer) != ESP_OK) {
+      ESP_LOGE("DIMMER", "Failed to switch to PWM mode %s", mode.name);
+      return false;
+    }
+    m_mode = &mode;
+    ESP_LOGI("DIMMER", "PWM mode %s: %d bit @ %lu Hz", mode.name,
+             static_cast<int>(mode.resolution),
+             static_cast<unsigned long>(mode.freq_hz));
+    return true;
+  }
+
+  const PwmMode *m_mode;
+};
@@ -1,53 +1,176 @@
-#include <cmath>
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <driver/gpio.h>
 #include <driver/ledc.h>
 #include <esp_log.h>
+#include <esp_sleep.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <time.h>
-#include <unordered_map>
-class LedTime {
+
+#include "led_dimmer.hpp"
+
+struct LedChannel {
+  gpio_num_t gpio;
+  ledc_channel_t channel;
+};
+
+// The dial covers 12 hours and is split into 2 * N equal slots. With 6 LEDs
+// a slot is one hour: LED i fades in during hour i, stays on for hours
+// i + 1 ... i + 5 and fades out during hour i + 6.
+static constexpr int kDialMinutes = 12 * 60;
+
+// Brightness frames are stored as Q16, 65535 is full brightness
+static constexpr uint32_t kFrameMax = 0xffff;
+
+namespace led_time_detail {
+
+// std::exp is not constexpr, a Taylor series is plenty for x in [0, 3]
+constexpr double exp(double x) {
+  double sum = 1.0;
+  double term = 1.0;
+  for (int n = 1; n < 40; n++) {
+    term *= x / n;
+    sum += term;
+  }
+  return sum;
+}
+
+// Exponential brightness curve, so that perceived brightness increases
+// roughly linearly with intensity
+constexpr uint16_t brightness_frame(double intensity, double steepness = 3) {
+  const double normalized = (exp(steepness * intensity) - 1) /
+                            (exp(steepness) - 1);
+  return static_cast<uint16_t>(normalized * kFrameMax + 0.5);
+}
+
+template <size_t N>
+constexpr std::array<std::array<uint16_t, N>, kDialMinutes> make_frames() {
+  static_assert(N > 0 && kDialMinutes % (2 * N) == 0,
+                "the dial has to split evenly into 2 * N slots");
+  constexpr int kSlotMinutes = kDialMinutes / (2 * N);
+
+  // Only slot_minutes + 1 distinct intensities exist, evaluate each once
+  std::array<uint16_t, kSlotMinutes + 1> curve{};
+  for (int step = 0; step <= kSlotMinutes; step++) {
+    curve[step] = brightness_frame(static_cast<double>(step) / kSlotMinutes);
+  }
+
+  std::array<std::array<uint16_t, N>, kDialMinutes> frames{};
+  for (int minute = 0; minute < kDialMinutes; minute++) {
+    const int slot = minute / kSlotMinutes;
+    const int step = minute % kSlotMinutes;
+    for (int i = 0; i < static_cast<int>(N); i++) {
+      uint16_t frame = 0;
+      if (slot >= i + 1 && slot < i + static_cast<int>(N)) {
+        frame = curve[kSlotMinutes];
+      } else if (slot == i) {
+        frame = curve[step];
+      } else if (slot == i + static_cast<int>(N)) {
+        frame = curve[kSlotMinutes - step];
+      }
+      frames[minute][i] = frame;
+    }
+  }
+  return frames;
+}
+
+} // namespace led_time_detail
+
+// Displays the time on N LEDs. `Layout` provides the wiring as
+// `static constexpr std::array<LedChannel, N> kLeds`. Everything that
+// depends on the time of day is precomputed into a flash table at compile
+// time, update() only scales one row by the ambient light.
+template <size_t N, typename Layout> class LedTime {
+  static_assert(Layout::kLeds.size() == N, "layout must describe N LEDs");
+
 public:
-  LedTime(std::unordered_map<int, std::pair<gpio_num_t, ledc_channel_t>>
-              &gpio_config)
-      : m_gpio_config(gpio_config) {
-    assert(m_gpio_config.size() == 6);
-    for (const auto &pair : m_gpio_config) {
-      const auto gpio_num_and_led_channel = pair.second;
-      configure_gpio_pin_for_led(gpio_num_and_led_channel.first);
-      led_pwm(gpio_num_and_led_channel.first, gpio_num_and_led_channel.second);
+  static constexpr auto kFrames = led_time_detail::make_frames<N>();
+
+  LedTime() {
+    // Lets the LEDC hardware ramp duties on its own, see update()
+    ledc_fade_func_install(0);
+    // The LEDC timer runs from RC_FAST, keep it on through automatic light
+    // sleep so the LEDs stay lit
+    esp_sleep_pd_config(ESP_PD_DOMAIN_RC_FAST, ESP_PD_OPTION_ON);
+    for (const auto &led : Layout::kLeds) {
+      configure_gpio_pin_for_led(led.gpio);
+      led_pwm(led.gpio, led.channel);
     }
   }
 
-  void update(const tm &timeinfo, const float light_sensor_reading) {
-    const auto hour_12 = timeinfo.tm_hour % 12;
-    const float hour_fraction = timeinfo.tm_min / 60.0f;
-    for (int i = 0; i < 6; i++) {
-      float intensity = 0.0f;
-      if (hour_12 >= i + 1 && hour_12 < 6 + i) {
-        intensity = 1.0f;
-      } else {
-        if (hour_12 == i) {
-          intensity = hour_fraction;
-        }
+  // Shows `timeinfo`. With a `fade_ms`, every channel is instead faded
+  // from its current duty to where it has to be `fade_ms` from now, and the
+  // LEDC peripheral does the ramp on its own while the CPU sleeps.
+  //
+  // The hardware stretches a fade to at most 1023 PWM cycles per duty step.
+  // Slower fades finish early, which only happens for deltas of a few steps.
+  void update(const tm &timeinfo, const float light_sensor_reading,
+              uint32_t fade_ms = 0) {
+    const uint32_t scale = light_scale(light_sensor_reading);
+    const uint32_t now = dial_seconds(timeinfo);
 
-        if (hour_12 == i + 6) {
-          intensity = 1.0f - hour_fraction;
-        }
+    const PwmMode &mode = m_dimmer.mode_for(scale);
+    if (&mode != &m_dimmer.mode()) {
+      stop_fades();
+      if (m_dimmer.set_mode(mode)) {
+        // Old duties are meaningless at the new resolution, jump to the
+        // current frame before fading on
+        set_duties(now, scale);
       }
-      // ESP_LOGI("LED_STATUS", "LED: %i hour_fraction: %f intensity: %f", i,
-      // hour_fraction, intensity);
-      //  Change duty cycle
-      ledc_set_duty(LEDC_LOW_SPEED_MODE, m_gpio_config[i].second,
-                    intensityCalibration(intensity, light_sensor_reading));
-      ledc_update_duty(LEDC_LOW_SPEED_MODE, m_gpio_config[i].second);
+    }
+
+    if (fade_ms == 0) {
+      set_duties(now, scale);
+      return;
+    }
+
+    const uint32_t target = now + fade_ms / 1000;
+    for (size_t i = 0; i < N; i++) {
+      const auto channel = Layout::kLeds[i].channel;
+      ledc_fade_stop(LEDC_LOW_SPEED_MODE, channel);
+      ledc_set_fade_with_time(LEDC_LOW_SPEED_MODE, channel,
+                              m_dimmer.to_duty(frame_at(target, i), scale),
+                              fade_ms);
+      ledc_fade_start(LEDC_LOW_SPEED_MODE, channel, LEDC_FADE_NO_WAIT);
     }
   }
 
+  // Seconds from `timeinfo` to the next minute boundary the display needs a
+  // new update at. Between updates the hardware fades linearly, so a
+  // boundary is fine as long as that straight line stays within one duty
+  // step of every per-minute duty on the way. Flat stretches (LEDs fully on
+  // or off, the bottom of the curve in the dark) allow long sleeps. Returns
+  // the last boundary within `max_s` if nothing needs an update before, and
+  // never less than the first boundary at or after `min_s`.
+  uint32_t seconds_until_update(const tm &timeinfo,
+                                const float light_sensor_reading,
+                                uint32_t min_s, uint32_t max_s) const {
+    const uint32_t scale = light_scale(light_sensor_reading);
+    const uint32_t now = dial_seconds(timeinfo);
+    const uint32_t minute = now / 60;
+    // If the PWM mode is about to switch, every duty changes
+    const bool mode_switch = &m_dimmer.mode_for(scale) != &m_dimmer.mode();
+
+    uint32_t until = 60 - now % 60;
+    for (uint32_t minutes = 2; until + 60 <= max_s; minutes++) {
+      if (until >= min_s &&
+          (mode_switch || !fade_is_accurate(minute, minutes, scale))) {
+        break;
+      }
+      until += 60;
+    }
+    return until;
+  }
+
   void demo_mode() {
     while (true) {
       tm timeinfo{0};
-      for (int h = 0; 0 < 24; h++) {
+      for (int h = 0; h < 24; h++) {
         for (int m = 0; m < 60; m++) {
           timeinfo.tm_hour = h;
           timeinfo.tm_min = m;
@@ -60,64 +183,106 @@ public:
   }
 
   void turn_off() {
-    for (int i = 0; i < 6; i++) {
-      ledc_set_duty(LEDC_LOW_SPEED_MODE, m_gpio_config[i].second, 0);
-      ledc_update_duty(LEDC_LOW_SPEED_MODE, m_gpio_config[i].second);
+    stop_fades();
+    for (const auto &led : Layout::kLeds) {
+      ledc_set_duty(LEDC_LOW_SPEED_MODE, led.channel, 0);
+      ledc_update_duty(LEDC_LOW_SPEED_MODE, led.channel);
     }
   }
 
+  static uint32_t dial_seconds(const tm &timeinfo) {
+    return (timeinfo.tm_hour % 12) * 3600 + timeinfo.tm_min * 60 +
+           timeinfo.tm_sec;
+  }
+
+  // Brightness of LED i at `seconds` into the dial, interpolated between
+  // the per-minute frames
+  static uint32_t frame_at(uint32_t seconds, size_t i) {
+    const uint32_t minute = (seconds / 60) % kDialMinutes;
+    const uint32_t next = (minute + 1) % kDialMinutes;
+    const uint32_t second = seconds % 60;
+    return (kFrames[minute][i] * (60 - second) + kFrames[next][i] * second) /
+           60;
+  }
+
+  // Ambient light as Q8 factor: dark rooms dim to 10%, anything brighter
+  // than a fifth of the sensor range gets full brightness, or whatever
+  // set_max_light_scale() allows
+  uint32_t light_scale(const float light_sensor_reading) const {
+    static constexpr int32_t kMinScale = 26; // ~0.1
+    static constexpr int32_t kMaxScale = 256;
+    const auto scale = static_cast<int32_t>(light_sensor_reading * 5 * 256);
+    return std::min<uint32_t>(std::clamp(scale, kMinScale, kMaxScale),
+                              m_max_light_scale);
+  }
+
+  // Caps the brightness, e.g. to stretch a low battery
+  void set_max_light_scale(uint32_t max_light_scale) {
+    m_max_light_scale = max_light_scale;
+  }
+
 private:
-  int intensityCalibration(float intensity, const float light_sensor_reading,
-                           float steepness = 3) {
-    static constexpr int kMaxIntensity = 1023;
-    static constexpr int kMinIntensity = 0;
+  LedDimmer m_dimmer;
+  uint32_t m_max_light_scale = 256;
 
-    // Calculate the interpolated value
-    double normalized = (exp(steepness * intensity) - 1) / (exp(steepness) - 1);
-    double light_sensor_factor =
-        std::max(0.1f, std::min(1.0f, light_sensor_reading * 5));
-    double y = kMinIntensity + (kMaxIntensity - kMinIntensity) * normalized *
-                                   light_sensor_factor;
+  void set_duties(uint32_t seconds, uint32_t scale) {
+    for (size_t i = 0; i < N; i++) {
+      //  Change duty cycle
+      ledc_set_duty(LEDC_LOW_SPEED_MODE, Layout::kLeds[i].channel,
+                    m_dimmer.to_duty(frame_at(seconds, i), scale));
+      ledc_update_duty(LEDC_LOW_SPEED_MODE, Layout::kLeds[i].channel);
+    }
+  }
 
-    // Convert to integer and return
-    return static_cast<int>(y);
+  int32_t duty_at_minute(uint32_t minute, size_t i, uint32_t scale) const {
+    return m_dimmer.to_duty(kFrames[minute % kDialMinutes][i], scale);
   }
 
-  std::unordered_map<int, std::pair<gpio_num_t, ledc_channel_t>> m_gpio_config;
+  // Whether a linear fade over `minutes` starting at `minute` stays within
+  // one duty step of the exact curve on every channel
+  bool fade_is_accurate(uint32_t minute, uint32_t minutes,
+                        uint32_t scale) const {
+    for (size_t i = 0; i < N; i++) {
+      const int32_t start = duty_at_minute(minute, i, scale);
+      const int32_t end = duty_at_minute(minute + minutes, i, scale);
+      for (uint32_t step = 1; step < minutes; step++) {
+        const int32_t linear = start + (end - start) *
+                                           static_cast<int32_t>(step) /
+                                           static_cast<int32_t>(minutes);
+        const int32_t exact = duty_at_minute(minute + step, i, scale);
+        if (linear - exact > 1 || exact - linear > 1) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  void stop_fades() {
+    for (const auto &led : Layout::kLeds) {
+      ledc_fade_stop(LEDC_LOW_SPEED_MODE, led.channel);
+    }
+  }
 
   /**
-   * @brief Configures and initializes a PWM signal for an LED on a specified
-   * GPIO pin.
+   * @brief Attaches an LED on a specified GPIO pin to a PWM channel.
    *
-   * This function sets up a PWM (Pulse Width Modulation) signal for controlling
-   * an LED. It initializes the PWM timer and configures the PWM channel with
-   * the specified duty cycle. The frequency and resolution are predefined
-   * within the function.
+   * The channel runs on LEDC_TIMER_0, which is owned by the LedDimmer. Its
+   * frequency and duty resolution change with the ambient light, so duty
+   * values have to come from LedDimmer::to_duty().
    *
    * @param pin The GPIO number to which the LED is connected.
    * @param channel The LEDC channel to be used. This should be of type
    * ledc_channel_t.
-   * @param duty The duty cycle of the PWM signal. It ranges from 0 (off) to the
-   * maximum resolution defined by LEDC_TIMER_10_BIT (1023). Default is 0 (off).
+   * @param duty The initial duty cycle of the PWM signal. Default is 0 (off).
    *
    * @note Ensure that the GPIO pin supports PWM functions and the channel does
    * not conflict with other PWM channels in use.
    */
   void led_pwm(gpio_num_t pin, ledc_channel_t channel, uint32_t duty = 0) {
-    // Setup PWM configuration
-    ledc_timer_config_t ledc_timer = {
-        .speed_mode = LEDC_LOW_SPEED_MODE,    // timer mode
-        .duty_resolution = LEDC_TIMER_10_BIT, // resolution of PWM duty
-        .timer_num = LEDC_TIMER_0,            // timer index
-        .freq_hz = 1000,                      // frequency of PWM signal
-        .clk_cfg =
-            LEDC_USE_RC_FAST_CLK, // LEDC_USE_RC_FAST_CLK survices light sleep
-    };
-    ledc_timer_config(&ledc_timer);
-
     // Configure the LED control
     ledc_channel_config_t ledc_channel = {
-        .gpio_num = pin, // Change to your GPIO pin
+        .gpio_num = pin,
         .speed_mode = LEDC_LOW_SPEED_MODE,
         .channel = channel,
         .timer_sel = LEDC_TIMER_0,
@@ -128,11 +293,11 @@ private:
 
   void configure_gpio_pin_for_led(gpio_num_t gpio_num) {
     gpio_config_t config;
-    config.pin_bit_mask = (1 << gpio_num);
+    config.pin_bit_mask = (1ULL << gpio_num);
     config.mode = GPIO_MODE_OUTPUT;
     config.pull_up_en = GPIO_PULLUP_ENABLE;
     config.pull_down_en = GPIO_PULLDOWN_DISABLE;
     config.intr_type = GPIO_INTR_DISABLE;
     gpio_config(&config);
   }
-};
\ No newline at end of file
+};
@@ -1,14 +1,39 @@
+#pragma once
+
+#include <cstdint>
+
 #include "driver/adc.h"
-#include "esp_adc_cal.h"
-
-void init_adc(const adc1_channel_t adc_channel) {
-  adc1_config_width(ADC_WIDTH_BIT_12); // Configure the ADC resolution
-  adc1_config_channel_atten(
-      adc_channel, ADC_ATTEN_DB_11); // Replace ADC1_CHANNEL_6 with your channel
-}
-
-float read_adc_value(const adc1_channel_t adc_channel) {
-  int adc_value =
-      adc1_get_raw(adc_channel); // Replace ADC1_CHANNEL_6 with your channel
-  return static_cast<float>(adc_value) / pow(2, ADC_WIDTH_BIT_12);
-}
\ No newline at end of file
+
+// How a channel is sampled and filtered
+struct AdcSampling {
+  uint32_t burst_span_us; // spread the burst over this long, 0 = back to back
+  uint8_t iir_shift;      // filter weight of a new reading is 1 / 2^shift
+};
+
+// Lamps flicker at twice the mains frequency. Spreading the burst over
+// 10 ms covers a whole flicker period at 50 Hz and most of one at 60 Hz.
+// The filter follows quickly, someone just switched the light on.
+static constexpr AdcSampling kLightSensorSampling{10000, 1};
+// The cell changes slowly, so filter hard. A single bad reading must not
+// send the clock into deep sleep.
+static constexpr AdcSampling kBatterySampling{0, 3};
+
+static constexpr uint32_t kAdcFullScaleMv = 3300;
+
+void init_adc(const adc1_channel_t adc_channel, const AdcSampling &sampling);
+
+// Takes a burst of samples, applies the eFuse calibration and runs the
+// channel's median-of-3 + IIR filter. Filter state lives in RTC memory and
+// survives sleep.
+uint32_t read_adc_millivolts(const adc1_channel_t adc_channel);
+
+// Same, normalized to 0..1 of kAdcFullScaleMv
+float read_adc_value(const adc1_channel_t adc_channel);
+
+// Drops the filter history, the next reading starts it over from the
+// median of three bursts. For readings that are stale after a long sleep.
+void reset_adc_filter(const adc1_channel_t adc_channel);
+
+// Raw 12 bit reading that calibrates to `mv`, for code that can't run the
+// calibration itself (the deep sleep wake stub). Requires init_adc().
+uint32_t adc_millivolts_to_raw(uint32_t mv);
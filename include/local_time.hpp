@@ -0,0 +1,12 @@
+#pragma once
+
+#include <ctime>
+
+// Switches the zone, a POSIX TZ string, for local_time_from_utc() and for
+// newlib's own localtime(). An unparseable zone falls back to UTC.
+void local_time_set_zone(const char *posix_tz);
+
+// UTC to local time. The offset and the next transition are cached in RTC
+// memory, the TZ rules only get evaluated again once that transition passed
+// or the zone changed.
+void local_time_from_utc(time_t utc, tm &local);
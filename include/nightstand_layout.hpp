@@ -0,0 +1,18 @@
+#pragma once
+
+#include <array>
+
+#include "led_time.hpp"
+
+// LED i shows hour i of the 12 hour dial
+struct NightstandLayout {
+  static constexpr std::array<LedChannel, 6> kLeds{{
+      {GPIO_NUM_13, LEDC_CHANNEL_0},
+      {GPIO_NUM_12, LEDC_CHANNEL_1},
+      {GPIO_NUM_14, LEDC_CHANNEL_2},
+      {GPIO_NUM_27, LEDC_CHANNEL_3},
+      {GPIO_NUM_26, LEDC_CHANNEL_4},
+      {GPIO_NUM_25, LEDC_CHANNEL_5},
+  }};
+};
+using ClockLeds = LedTime<6, NightstandLayout>;
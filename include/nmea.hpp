@@ -0,0 +1,223 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// NMEA 0183 limits a sentence to 82 characters including "$" and "\r\n".
+// Some receivers overshoot a little, so leave some headroom.
+static constexpr size_t kNmeaMaxSentenceLength = 96;
+static constexpr size_t kNmeaMaxFields = 24;
+
+// A checksum-verified sentence, split into fields in place. Separators are
+// replaced by '\0' so every field is a C string pointing into `buffer`.
+struct NmeaSentence {
+  char buffer[kNmeaMaxSentenceLength];
+  uint8_t field_offsets[kNmeaMaxFields];
+  uint8_t field_count = 0;
+
+  // Field 0 is the address ("GPRMC", "GNZDA", ...). Missing trailing fields
+  // read as empty strings, just like empty ones.
+  const char *field(size_t index) const {
+    return index < field_count ? buffer + field_offsets[index] : "";
+  }
+};
+
+// Incremental NMEA framer. Bytes are fed one at a time straight from the
+// UART; a '$' always starts a new sentence, so garbage and truncated
+// sentences resynchronize on their own. No heap allocations.
+class NmeaParser {
+public:
+  // Returns true once a complete sentence with a valid "*hh" checksum has
+  // been received. It stays available via sentence() until the next '$'.
+  bool feed(uint8_t byte) {
+    if (byte == '$') {
+      m_state = State::kBody;
+      m_length = 0;
+      m_checksum = 0;
+      m_sentence.field_count = 1;
+      m_sentence.field_offsets[0] = 0;
+      return false;
+    }
+
+    switch (m_state) {
+    case State::kIdle:
+      return false;
+
+    case State::kBody:
+      if (byte == '*') {
+        m_state = append('\0') ? State::kChecksumHigh : State::kIdle;
+        return false;
+      }
+      if (byte < 0x20 || byte > 0x7e) {
+        // CR/LF without checksum, or binary noise
+        m_state = State::kIdle;
+        return false;
+      }
+      m_checksum ^= byte;
+      if (byte == ',') {
+        if (m_sentence.field_count == kNmeaMaxFields || !append('\0')) {
+          m_state = State::kIdle;
+          return false;
+        }
+        m_sentence.field_offsets[m_sentence.field_count++] = m_length;
+        return false;
+      }
+      if (!append(static_cast<char>(byte))) {
+        m_state = State::kIdle;
+      }
+      return false;
+
+    case State::kChecksumHigh: {
+      const int nibble = hex_value(byte);
+      if (nibble < 0) {
+        m_state = State::kIdle;
+        return false;
+      }
+      m_received_checksum = static_cast<uint8_t>(nibble << 4);
+      m_state = State::kChecksumLow;
+      return false;
+    }
+
+    case State::kChecksumLow: {
+      const int nibble = hex_value(byte);
+      m_state = State::kIdle;
+      if (nibble < 0 || (m_received_checksum | nibble) != m_checksum) {
+        m_checksum_errors++;
+        return false;
+      }
+      return true;
+    }
+    }
+    return false;
+  }
+
+  const NmeaSentence &sentence() const { return m_sentence; }
+  uint32_t checksum_errors() const { return m_checksum_errors; }
+
+private:
+  enum class State : uint8_t { kIdle, kBody, kChecksumHigh, kChecksumLow };
+
+  bool append(char c) {
+    if (m_length >= kNmeaMaxSentenceLength) {
+      return false;
+    }
+    m_sentence.buffer[m_length++] = c;
+    return true;
+  }
+
+  static int hex_value(uint8_t c) {
+    if (c >= '0' && c <= '9')
+      return c - '0';
+    if (c >= 'A' && c <= 'F')
+      return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f')
+      return c - 'a' + 10;
+    return -1;
+  }
+
+  NmeaSentence m_sentence;
+  State m_state = State::kIdle;
+  uint8_t m_length = 0;
+  uint8_t m_checksum = 0;
+  uint8_t m_received_checksum = 0;
+  uint32_t m_checksum_errors = 0;
+};
+
+// Parses exactly `count` decimal digits. Returns false on anything else.
+inline bool nmea_parse_digits(const char *s, size_t count, int32_t &value) {
+  value = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (s[i] < '0' || s[i] > '9') {
+      return false;
+    }
+    value = value * 10 + (s[i] - '0');
+  }
+  return true;
+}
+
+// "hhmmss" or "hhmmss.ss" -> hour, minute, second, hundredths of a second
+inline bool nmea_parse_time(const char *s, int32_t &hour, int32_t &minute,
+                            int32_t &second, int32_t &centiseconds) {
+  if (!nmea_parse_digits(s, 2, hour) || !nmea_parse_digits(s + 2, 2, minute) ||
+      !nmea_parse_digits(s + 4, 2, second)) {
+    return false;
+  }
+  if (hour > 23 || minute > 59 || second > 60) {
+    return false;
+  }
+
+  centiseconds = 0;
+  if (s[6] == '.') {
+    int32_t scale = 10;
+    for (const char *c = s + 7; *c != '\0' && scale > 0; c++, scale /= 10) {
+      if (*c < '0' || *c > '9') {
+        return false;
+      }
+      centiseconds += (*c - '0') * scale;
+    }
+  } else if (s[6] != '\0') {
+    return false;
+  }
+  return true;
+}
+
+// "ddmmyy" -> day, month (1-12), full year
+inline bool nmea_parse_date(const char *s, int32_t &day, int32_t &month,
+                            int32_t &year) {
+  if (std::strlen(s) != 6 || !nmea_parse_digits(s, 2, day) ||
+      !nmea_parse_digits(s + 2, 2, month) ||
+      !nmea_parse_digits(s + 4, 2, year)) {
+    return false;
+  }
+  year += 2000;
+  return day >= 1 && day <= 31 && month >= 1 && month <= 12;
+}
+
+// "ddmm.mmmm" / "dddmm.mmmm" plus hemisphere -> degrees * 1e7, the same
+// fixed-point scale u-blox uses for its binary protocol.
+inline bool nmea_parse_coordinate(const char *value, const char *hemisphere,
+                                  int32_t &degrees_e7) {
+  const char *dot = std::strchr(value, '.');
+  const size_t int_digits = dot ? dot - value : std::strlen(value);
+  if (int_digits < 3 || int_digits > 5 || hemisphere[0] == '\0' ||
+      hemisphere[1] != '\0') {
+    return false;
+  }
+
+  int32_t degrees = 0;
+  int32_t minutes = 0;
+  if (!nmea_parse_digits(value, int_digits - 2, degrees) ||
+      !nmea_parse_digits(value + int_digits - 2, 2, minutes) ||
+      minutes >= 60) {
+    return false;
+  }
+
+  // minutes with 5 decimals, ~2 cm resolution
+  int64_t minutes_e5 = static_cast<int64_t>(minutes) * 100000;
+  if (dot) {
+    int32_t scale = 10000;
+    for (const char *c = dot + 1; *c != '\0'; c++, scale /= 10) {
+      if (*c < '0' || *c > '9') {
+        return false;
+      }
+      minutes_e5 += (*c - '0') * scale;
+    }
+  }
+
+  int64_t result = static_cast<int64_t>(degrees) * 10000000 +
+                   minutes_e5 * 10 / 6; // 1e7 / (60 * 1e5)
+  switch (hemisphere[0]) {
+  case 'N':
+  case 'E':
+    break;
+  case 'S':
+  case 'W':
+    result = -result;
+    break;
+  default:
+    return false;
+  }
+  degrees_e7 = static_cast<int32_t>(result);
+  return true;
+}
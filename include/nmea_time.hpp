@@ -0,0 +1,191 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <optional>
+
+#include "civil_time.hpp"
+#include "nmea.hpp"
+
+// Earlier dates come from a receiver's RTC that was never set, not from
+// satellites
+static constexpr int32_t kNmeaMinPlausibleYear = 2023;
+
+// The sentences that carry UTC, whatever constellation they come from
+enum class NmeaSentenceType : uint8_t { kUnknown, kRmc, kZda, kGga, kGll };
+
+// "GPRMC", "GNRMC", "GLRMC", "GARMC", "BDRMC" ... are all RMC
+inline NmeaSentenceType nmea_sentence_type(const NmeaSentence &sentence) {
+  const char *address = sentence.field(0);
+  if (std::strlen(address) != 5) {
+    return NmeaSentenceType::kUnknown;
+  }
+  const char *type = address + 2;
+  if (std::strcmp(type, "RMC") == 0) {
+    return NmeaSentenceType::kRmc;
+  }
+  if (std::strcmp(type, "ZDA") == 0) {
+    return NmeaSentenceType::kZda;
+  }
+  if (std::strcmp(type, "GGA") == 0) {
+    return NmeaSentenceType::kGga;
+  }
+  if (std::strcmp(type, "GLL") == 0) {
+    return NmeaSentenceType::kGll;
+  }
+  return NmeaSentenceType::kUnknown;
+}
+
+// The time, and whatever else matters to us, read from one sentence
+struct NmeaTimeReading {
+  NmeaSentenceType type;
+  int32_t year; // year, month and day only with has_date
+  int32_t month;
+  int32_t day;
+  int32_t hour;
+  int32_t minute;
+  int32_t second;
+  int32_t centiseconds;
+  int32_t latitude_e7; // only with has_position
+  int32_t longitude_e7;
+  bool has_date;
+  bool has_position;
+  bool fix; // the receiver reports a valid position fix
+};
+
+// RMC: time, status, lat, N/S, lon, E/W, speed, course, date, ...
+inline bool nmea_read_rmc(const NmeaSentence &sentence, NmeaTimeReading &r) {
+  if (sentence.field_count < 10 ||
+      !nmea_parse_date(sentence.field(9), r.day, r.month, r.year)) {
+    return false;
+  }
+  r.has_date = true;
+  r.fix = sentence.field(2)[0] == 'A';
+  r.has_position =
+      nmea_parse_coordinate(sentence.field(3), sentence.field(4),
+                            r.latitude_e7) &&
+      nmea_parse_coordinate(sentence.field(5), sentence.field(6),
+                            r.longitude_e7);
+  return true;
+}
+
+// ZDA: time, day, month, four digit year, local zone. Date and time come
+// from the receiver's clock, with no flag telling whether it was ever set,
+// so a ZDA reading never counts as a fix.
+inline bool nmea_read_zda(const NmeaSentence &sentence, NmeaTimeReading &r) {
+  if (sentence.field_count < 5 || std::strlen(sentence.field(2)) != 2 ||
+      std::strlen(sentence.field(3)) != 2 ||
+      std::strlen(sentence.field(4)) != 4 ||
+      !nmea_parse_digits(sentence.field(2), 2, r.day) ||
+      !nmea_parse_digits(sentence.field(3), 2, r.month) ||
+      !nmea_parse_digits(sentence.field(4), 4, r.year) || r.day < 1 ||
+      r.day > 31 || r.month < 1 || r.month > 12) {
+    return false;
+  }
+  r.has_date = true;
+  return true;
+}
+
+// GGA: time, lat, N/S, lon, E/W, fix quality (0 = none), ...
+inline bool nmea_read_gga(const NmeaSentence &sentence, NmeaTimeReading &r) {
+  if (sentence.field_count < 7) {
+    return false;
+  }
+  const char quality = sentence.field(6)[0];
+  r.fix = quality != '\0' && quality != '0';
+  r.has_position =
+      nmea_parse_coordinate(sentence.field(2), sentence.field(3),
+                            r.latitude_e7) &&
+      nmea_parse_coordinate(sentence.field(4), sentence.field(5),
+                            r.longitude_e7);
+  return true;
+}
+
+// GLL: lat, N/S, lon, E/W, time, status, mode ('N' = not valid)
+inline bool nmea_read_gll(const NmeaSentence &sentence, NmeaTimeReading &r) {
+  if (sentence.field_count < 7) {
+    return false;
+  }
+  r.fix = sentence.field(6)[0] == 'A' && sentence.field(7)[0] != 'N';
+  r.has_position =
+      nmea_parse_coordinate(sentence.field(1), sentence.field(2),
+                            r.latitude_e7) &&
+      nmea_parse_coordinate(sentence.field(3), sentence.field(4),
+                            r.longitude_e7);
+  return true;
+}
+
+// Dispatches on the sentence type, any talker
+inline std::optional<NmeaTimeReading>
+nmea_read_time(const NmeaSentence &sentence) {
+  NmeaTimeReading r = {};
+  r.type = nmea_sentence_type(sentence);
+
+  // Every type but GLL has the time right after the address
+  const size_t time_field = r.type == NmeaSentenceType::kGll ? 5 : 1;
+  if (r.type == NmeaSentenceType::kUnknown ||
+      !nmea_parse_time(sentence.field(time_field), r.hour, r.minute, r.second,
+                       r.centiseconds)) {
+    return std::nullopt;
+  }
+
+  bool valid = false;
+  switch (r.type) {
+  case NmeaSentenceType::kRmc:
+    valid = nmea_read_rmc(sentence, r);
+    break;
+  case NmeaSentenceType::kZda:
+    valid = nmea_read_zda(sentence, r);
+    break;
+  case NmeaSentenceType::kGga:
+    valid = nmea_read_gga(sentence, r);
+    break;
+  case NmeaSentenceType::kGll:
+    valid = nmea_read_gll(sentence, r);
+    break;
+  case NmeaSentenceType::kUnknown:
+    break;
+  }
+  if (!valid) {
+    return std::nullopt;
+  }
+  return r;
+}
+
+// The UTC a reading stands for, if it can be trusted, whatever sentence or
+// constellation it came from. Without a fix the receiver may be reporting
+// its unsynchronized default time, so a fix is always required:
+//  - with a date (RMC): and a plausible year
+//  - time of day only (GGA, GLL): and a clock that already has the right
+//    date. `local_us` then picks the day within +/- 12 h.
+inline std::optional<int64_t>
+nmea_reading_utc_us(const NmeaTimeReading &r, int64_t local_us,
+                    bool local_valid) {
+  const int64_t time_of_day_us =
+      (r.hour * 3600LL + r.minute * 60 + r.second) * 1000000 +
+      r.centiseconds * 10000LL;
+
+  if (!r.fix) {
+    return std::nullopt;
+  }
+  if (r.has_date) {
+    if (r.year < kNmeaMinPlausibleYear) {
+      return std::nullopt;
+    }
+    return days_from_civil(r.year, r.month, r.day) * kSecondsPerDay *
+               1000000 +
+           time_of_day_us;
+  }
+
+  if (!local_valid) {
+    return std::nullopt;
+  }
+  static constexpr int64_t kDayUs = kSecondsPerDay * 1000000;
+  int64_t utc_us = local_us - local_us % kDayUs + time_of_day_us;
+  if (utc_us - local_us > kDayUs / 2) {
+    utc_us -= kDayUs;
+  } else if (local_us - utc_us > kDayUs / 2) {
+    utc_us += kDayUs;
+  }
+  return utc_us;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+#include "drift_model.hpp"
+
+// SNTP (RFC 4330) client packets. Timestamps are seconds since 1900 and a
+// 32 bit binary fraction, big endian.
+static constexpr size_t kNtpPacketLength = 48;
+static constexpr uint16_t kNtpPort = 123;
+// 1900-01-01 to 1970-01-01
+static constexpr int64_t kNtpUnixOffsetS = 2208988800LL;
+
+static constexpr uint8_t kNtpVersion = 4;
+static constexpr uint8_t kNtpModeClient = 3;
+static constexpr uint8_t kNtpModeServer = 4;
+// Leap indicator of a server that isn't synchronized itself
+static constexpr uint8_t kNtpLeapAlarm = 3;
+// An offset beyond this many times the clock's expected error, plus the
+// slack, is the server's error and not the clock's
+static constexpr int64_t kNtpPlausibleErrorFactor = 4;
+static constexpr int64_t kNtpPlausibleSlackUs = 10 * 1000000LL;
+
+inline void ntp_put_timestamp(uint8_t *p, int64_t unix_us) {
+  const uint64_t seconds = unix_us / 1000000 + kNtpUnixOffsetS;
+  const uint64_t fraction = ((unix_us % 1000000) << 32) / 1000000;
+  for (int i = 0; i < 4; i++) {
+    p[i] = (seconds >> (24 - 8 * i)) & 0xff;
+    p[4 + i] = (fraction >> (24 - 8 * i)) & 0xff;
+  }
+}
+
+// Seconds wrap in 2036, a timestamp with the top bit clear is taken to be
+// from the era after
+inline int64_t ntp_get_timestamp(const uint8_t *p) {
+  uint64_t seconds = 0;
+  uint64_t fraction = 0;
+  for (int i = 0; i < 4; i++) {
+    seconds = (seconds << 8) | p[i];
+    fraction = (fraction << 8) | p[4 + i];
+  }
+  if (seconds < 0x80000000u) {
+    seconds += 0x100000000ULL;
+  }
+  return (static_cast<int64_t>(seconds) - kNtpUnixOffsetS) * 1000000 +
+         static_cast<int64_t>((fraction * 1000000) >> 32);
+}
+
+// The request carries our clock at sending in its transmit timestamp, the
+// server echoes it back as originate timestamp
+inline void ntp_request(int64_t transmit_us, uint8_t *packet) {
+  for (size_t i = 0; i < kNtpPacketLength; i++) {
+    packet[i] = 0;
+  }
+  packet[0] = (kNtpVersion << 3) | kNtpModeClient;
+  ntp_put_timestamp(packet + 40, transmit_us);
+}
+
+struct NtpResult {
+  int64_t offset_us; // add to the local clock to get the server's
+  int64_t delay_us;  // round trip minus the server's processing
+  uint8_t stratum;
+};
+
+// Checks an answer to the request sent at `transmit_us` and received at
+// `receive_us`, both on the local clock. Rejects anything that isn't a
+// synchronized server's answer to exactly that request.
+inline bool ntp_parse_response(const uint8_t *packet, size_t length,
+                               int64_t transmit_us, int64_t receive_us,
+                               NtpResult &result) {
+  if (length < kNtpPacketLength) {
+    return false;
+  }
+  const uint8_t leap = packet[0] >> 6;
+  const uint8_t mode = packet[0] & 0x07;
+  const uint8_t stratum = packet[1];
+  if (mode != kNtpModeServer || leap == kNtpLeapAlarm || stratum == 0 ||
+      stratum > 15) {
+    return false;
+  }
+  uint8_t originate[8];
+  ntp_put_timestamp(originate, transmit_us);
+  for (int i = 0; i < 8; i++) {
+    if (packet[24 + i] != originate[i]) {
+      return false;
+    }
+  }
+  const int64_t server_receive_us = ntp_get_timestamp(packet + 32);
+  const int64_t server_transmit_us = ntp_get_timestamp(packet + 40);
+  result.offset_us = ((server_receive_us - transmit_us) +
+                      (server_transmit_us - receive_us)) /
+                     2;
+  result.delay_us =
+      (receive_us - transmit_us) - (server_transmit_us - server_receive_us);
+  result.stratum = stratum;
+  return result.delay_us >= 0;
+}
+
+// Whether an answer that puts the clock `offset_us` off at `local_us` can
+// be right. Once synced, the drift corrected clock is known to within
+// drift_model_expected_error_us(); before that, anything goes.
+inline bool ntp_offset_plausible(const DriftModel &drift, int64_t local_us,
+                                 int64_t offset_us) {
+  if (drift.anchor_time_us == 0) {
+    return true;
+  }
+  return std::llabs(offset_us) <=
+         kNtpPlausibleErrorFactor *
+                 drift_model_expected_error_us(drift, local_us) +
+             kNtpPlausibleSlackUs;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+
+#include "drift_model.hpp"
+#include "gps_backoff.hpp"
+#include "time_source.hpp"
+#include "esp_err.h"
+
+// Where the last sync came from. kNoFix is no longer taken, but may still
+// be in NVS.
+enum class SyncQuality : uint8_t {
+  kNone = 0,
+  kNoFix = 1,    // time from a sentence flagged invalid ('V')
+  kFix = 2,      // time from a sentence with a valid fix ('A')
+  kUtcValid = 3, // UTC the receiver reports valid, leap seconds known
+  kSntp = 4,     // time from an NTP server
+};
+
+// Last position from a sentence with a valid fix, for aiding the receiver
+struct GpsPosition {
+  int64_t time; // UTC seconds, 0 if never
+  int32_t latitude_e7;
+  int32_t longitude_e7;
+};
+
+// State that has to survive light and deep sleep. The working copy lives in
+// RTC slow memory behind a CRC; NVS is only a backup for cold boots and is
+// written as rarely as possible to save flash wear and flash-on current.
+// New fields go at the end, see read_nvs().
+struct PersistentState {
+  int64_t last_sync_time; // UTC seconds of the latest sync, 0 if never
+  int64_t session_start_time; // first sync of the current GPS session
+  uint32_t sync_count;        // sentences accepted since first boot
+  uint32_t session_count;     // GPS sessions since first boot
+  uint32_t nvs_write_count;
+  SyncQuality sync_quality;
+  DriftModel drift;
+  GpsAttemptStats gps;
+  GpsPosition position;
+  SntpStats sntp;
+  // UTC seconds of the latest sync with a fix or valid UTC, 0 if never.
+  // GPS times before it are rejected, SNTP doesn't move it.
+  int64_t last_gps_sync_time;
+};
+
+// Restores the RTC copy after a reset. Uses the RTC block as-is when its
+// CRC is intact (wake from deep sleep), otherwise falls back to NVS.
+// Requires nvs_flash_init() to have been called.
+void persistent_state_init();
+
+PersistentState persistent_state_get();
+
+// Replaces the RTC copy. Significant changes are written through to NVS
+// right away, everything else waits for persistent_state_commit().
+void persistent_state_set(const PersistentState &state, bool significant);
+
+// Records a time sync and feeds it to the drift model. `local_us` is the
+// system clock just before it was set to `gps_us`. Only the first sync of a
+// session (no sync within kPersistentSessionGap) is significant enough to
+// hit NVS.
+void persistent_state_record_sync(int64_t gps_us, int64_t local_us,
+                                  SyncQuality quality);
+
+// Remembers the position of a valid fix. Stays RTC-only until the next
+// commit, a nightstand doesn't move much.
+void persistent_state_record_position(time_t time, int32_t latitude_e7,
+                                      int32_t longitude_e7);
+
+// Flushes pending changes to NVS if the last write is older than a day, or
+// unconditionally with `force` (e.g. before deep sleep on a low battery).
+esp_err_t persistent_state_commit(time_t now, bool force = false);
@@ -0,0 +1,256 @@
+#pragma once
+
+#include <climits>
+#include <cstdint>
+
+#include "civil_time.hpp"
+
+// When a switch to or from DST happens, one of the POSIX forms:
+//   Jn     day n of the year, 1-365, February 29th never counts
+//   n      day n of the year, 0-365
+//   Mm.w.d weekday d (0 = Sunday) of week w (1-4, 5 = last) of month m
+// at `time_s` local time, which may be negative or beyond a day
+struct PosixTzRule {
+  enum class Kind : uint8_t { kJulian1, kJulian0, kMonthWeekDay };
+  Kind kind;
+  int16_t day;
+  int8_t month;
+  int8_t week;
+  int32_t time_s;
+};
+
+// A parsed POSIX TZ string. Offsets are east of UTC, local = UTC + offset,
+// i.e. the opposite sign of the string.
+struct PosixTz {
+  int32_t std_offset_s;
+  int32_t dst_offset_s;
+  bool has_dst;
+  PosixTzRule start; // std -> dst
+  PosixTzRule end;   // dst -> std
+};
+
+namespace posix_tz_detail {
+
+// "UTC", "CET" or "<+0330>"
+inline bool parse_name(const char *&p) {
+  if (*p == '<') {
+    while (*p != '\0' && *p != '>') {
+      p++;
+    }
+    if (*p != '>') {
+      return false;
+    }
+    p++;
+    return true;
+  }
+  const char *start = p;
+  while ((*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z')) {
+    p++;
+  }
+  return p - start >= 3;
+}
+
+inline bool parse_number(const char *&p, int32_t max, int32_t &value) {
+  if (*p < '0' || *p > '9') {
+    return false;
+  }
+  value = 0;
+  while (*p >= '0' && *p <= '9') {
+    value = value * 10 + (*p++ - '0');
+    if (value > max) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// [+-]hh[:mm[:ss]], in seconds with the sign as written
+inline bool parse_time(const char *&p, int32_t max_hours, int32_t &seconds) {
+  int32_t sign = 1;
+  if (*p == '+' || *p == '-') {
+    sign = *p++ == '-' ? -1 : 1;
+  }
+  int32_t hours;
+  int32_t minutes = 0;
+  int32_t secs = 0;
+  if (!parse_number(p, max_hours, hours)) {
+    return false;
+  }
+  if (*p == ':') {
+    p++;
+    if (!parse_number(p, 59, minutes)) {
+      return false;
+    }
+    if (*p == ':') {
+      p++;
+      if (!parse_number(p, 59, secs)) {
+        return false;
+      }
+    }
+  }
+  seconds = sign * (hours * 3600 + minutes * 60 + secs);
+  return true;
+}
+
+inline bool parse_rule(const char *&p, PosixTzRule &rule) {
+  int32_t value;
+  if (*p == 'M') {
+    p++;
+    int32_t week;
+    int32_t weekday;
+    if (!parse_number(p, 12, value) || value < 1 || *p++ != '.' ||
+        !parse_number(p, 5, week) || week < 1 || *p++ != '.' ||
+        !parse_number(p, 6, weekday)) {
+      return false;
+    }
+    rule.kind = PosixTzRule::Kind::kMonthWeekDay;
+    rule.month = value;
+    rule.week = week;
+    rule.day = weekday;
+  } else if (*p == 'J') {
+    p++;
+    if (!parse_number(p, 365, value) || value < 1) {
+      return false;
+    }
+    rule.kind = PosixTzRule::Kind::kJulian1;
+    rule.day = value;
+  } else {
+    if (!parse_number(p, 365, value)) {
+      return false;
+    }
+    rule.kind = PosixTzRule::Kind::kJulian0;
+    rule.day = value;
+  }
+  rule.time_s = 2 * 3600;
+  if (*p == '/') {
+    p++;
+    // RFC 8536 allows -167 to 167 hours
+    return parse_time(p, 167, rule.time_s);
+  }
+  return true;
+}
+
+} // namespace posix_tz_detail
+
+// Parses "std offset [dst [offset] [,start[/time],end[/time]]]". Without
+// an offset std is UTC, which covers a plain "UTC". A dst without rules
+// gets the US ones.
+inline bool posix_tz_parse(const char *p, PosixTz &tz) {
+  using namespace posix_tz_detail;
+  tz = {};
+  if (!parse_name(p)) {
+    return false;
+  }
+  int32_t offset = 0;
+  if (*p == '\0') {
+    return true;
+  }
+  if (!parse_time(p, 24, offset)) {
+    return false;
+  }
+  tz.std_offset_s = -offset;
+  if (*p == '\0') {
+    return true;
+  }
+
+  if (!parse_name(p)) {
+    return false;
+  }
+  tz.has_dst = true;
+  tz.dst_offset_s = tz.std_offset_s + 3600;
+  if (*p != ',' && *p != '\0') {
+    if (!parse_time(p, 24, offset)) {
+      return false;
+    }
+    tz.dst_offset_s = -offset;
+  }
+  if (*p == '\0') {
+    const char *us_rules = "M3.2.0,M11.1.0";
+    parse_rule(us_rules, tz.start);
+    us_rules++;
+    return parse_rule(us_rules, tz.end);
+  }
+  return *p++ == ',' && parse_rule(p, tz.start) && *p++ == ',' &&
+         parse_rule(p, tz.end) && *p == '\0';
+}
+
+// Local midnight starting the rule's day in `year`, as days since the epoch
+inline int64_t posix_tz_rule_day(const PosixTzRule &rule, int32_t year) {
+  const int64_t jan1 = days_from_civil(year, 1, 1);
+  switch (rule.kind) {
+  case PosixTzRule::Kind::kJulian1:
+    return jan1 + rule.day - 1 + (is_leap_year(year) && rule.day >= 60);
+  case PosixTzRule::Kind::kJulian0:
+    return jan1 + rule.day;
+  case PosixTzRule::Kind::kMonthWeekDay:
+    break;
+  }
+  const int64_t first = days_from_civil(year, rule.month, 1);
+  // 1970-01-01 was a Thursday
+  const int32_t first_weekday = static_cast<int32_t>(((first + 4) % 7 + 7) % 7);
+  int32_t day = 1 + (rule.day - first_weekday + 7) % 7 + (rule.week - 1) * 7;
+  if (day > days_in_month(year, rule.month)) {
+    day -= 7;
+  }
+  return first + day - 1;
+}
+
+// UTC seconds of a transition in `year`, while `offset_before_s` applies
+inline int64_t posix_tz_transition(const PosixTzRule &rule, int32_t year,
+                                   int32_t offset_before_s) {
+  return posix_tz_rule_day(rule, year) * kSecondsPerDay + rule.time_s -
+         offset_before_s;
+}
+
+// The offset at `utc` and the span it holds for: from the last transition
+// up to the next one. Without DST that is forever.
+struct PosixTzSpan {
+  int64_t from;  // UTC seconds, first one the offset applies to
+  int64_t until; // UTC seconds of the next transition
+  int32_t offset_s;
+  bool dst;
+};
+
+inline PosixTzSpan posix_tz_span(const PosixTz &tz, int64_t utc) {
+  if (!tz.has_dst) {
+    return {INT64_MIN, INT64_MAX, tz.std_offset_s, false};
+  }
+  int32_t year;
+  int32_t month;
+  int32_t day;
+  civil_from_days((utc + tz.std_offset_s) / kSecondsPerDay -
+                      ((utc + tz.std_offset_s) % kSecondsPerDay < 0),
+                  year, month, day);
+
+  // Transitions of the years around, in order. Southern zones start DST
+  // late in the year and end it early, sorting takes care of that.
+  struct Transition {
+    int64_t utc;
+    bool to_dst;
+  } transitions[6];
+  int count = 0;
+  for (int32_t y = year - 1; y <= year + 1; y++) {
+    transitions[count++] = {
+        posix_tz_transition(tz.start, y, tz.std_offset_s), true};
+    transitions[count++] = {posix_tz_transition(tz.end, y, tz.dst_offset_s),
+                            false};
+  }
+  for (int i = 1; i < count; i++) {
+    for (int j = i; j > 0 && transitions[j].utc < transitions[j - 1].utc;
+         j--) {
+      const Transition t = transitions[j];
+      transitions[j] = transitions[j - 1];
+      transitions[j - 1] = t;
+    }
+  }
+
+  // The year before always has a transition before `utc`, the one after
+  // always one after it
+  int next = 0;
+  while (next < count && transitions[next].utc <= utc) {
+    next++;
+  }
+  const Transition &last = transitions[next - 1];
+  return {last.utc, transitions[next].utc,
+          last.to_dst ? tz.dst_offset_s : tz.std_offset_s, last.to_dst};
+}
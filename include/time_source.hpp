@@ -0,0 +1,161 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "drift_model.hpp"
+#include "gps_backoff.hpp"
+
+// Average draw of the radio while associating and talking to the server
+static constexpr uint32_t kWifiActiveCurrentMa = 110;
+// Radio time of an SNTP sync before there is any history: a reconnect with
+// the cached access point and address, one round trip
+static constexpr uint32_t kSntpDefaultRadioMs = 1500;
+// Until the first fix assume the warm budget is about what it takes
+static constexpr uint32_t kGpsDefaultTtfS = 60;
+// A source has to sync this much better than the drift target, or the
+// clock would be off by the sync error right after it
+static constexpr int64_t kTimeSourceErrorFraction = 10;
+
+static constexpr int64_t kSntpBackoffBaseS = 15 * 60;
+static constexpr int64_t kSntpBackoffMaxS = 24 * 3600;
+
+// Outcome of SNTP syncs since first boot, kept in the persistent state
+struct SntpStats {
+  int64_t next_attempt_time; // UTC seconds, 0 for right away
+  uint32_t attempts;
+  uint32_t failures;
+  uint32_t radio_ms_sum; // radio on time, summed over successful syncs
+  uint32_t last_radio_ms;
+  uint32_t last_delay_us; // round trip of the last sync
+  uint16_t consecutive_failures;
+};
+
+inline bool sntp_attempt_due(const SntpStats &stats, int64_t now) {
+  return now >= stats.next_attempt_time ||
+         stats.next_attempt_time - now > kSntpBackoffMaxS;
+}
+
+inline void sntp_attempt_on_success(SntpStats &stats, uint32_t radio_ms,
+                                    uint32_t delay_us) {
+  stats.attempts++;
+  stats.radio_ms_sum += radio_ms;
+  stats.last_radio_ms = radio_ms;
+  stats.last_delay_us = delay_us;
+  stats.consecutive_failures = 0;
+  stats.next_attempt_time = 0;
+}
+
+inline void sntp_attempt_on_failure(SntpStats &stats, int64_t now) {
+  stats.attempts++;
+  stats.failures++;
+  if (stats.consecutive_failures < UINT16_MAX) {
+    stats.consecutive_failures++;
+  }
+  int64_t delay_s = kSntpBackoffBaseS;
+  for (uint16_t i = 1;
+       i < stats.consecutive_failures && delay_s < kSntpBackoffMaxS; i++) {
+    delay_s *= 2;
+  }
+  stats.next_attempt_time =
+      now + (delay_s < kSntpBackoffMaxS ? delay_s : kSntpBackoffMaxS);
+}
+
+enum class TimeSource : uint8_t { kNone, kGps, kSntp };
+
+// What a sync from one source is expected to cost and deliver
+struct TimeSourceOption {
+  TimeSource source;
+  bool available; // configured, and not backing off
+  uint32_t cost_mas; // charge per successful sync, failures included
+  int64_t error_us;  // error of the synced clock
+  bool gives_position;
+};
+
+// Average charge of an attempt scaled by attempts per success, so a source
+// that often fails gets expensive
+inline uint32_t time_source_cost(uint64_t mas_per_attempt, uint32_t attempts,
+                                 uint32_t failures) {
+  const uint32_t successes = attempts - failures;
+  if (attempts == 0 || successes == 0) {
+    return static_cast<uint32_t>(mas_per_attempt * (failures + 1));
+  }
+  const uint64_t cost = mas_per_attempt * attempts / successes;
+  return cost > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(cost);
+}
+
+inline TimeSourceOption time_source_gps_option(const GpsAttemptStats &stats,
+                                               int64_t now) {
+  // Receiver on time per attempt, failures included
+  const uint32_t on_s = stats.attempts > 0 ? stats.on_time_s / stats.attempts
+                                           : kGpsDefaultTtfS;
+  return {.source = TimeSource::kGps,
+          .available = gps_attempt_due(stats, now),
+          .cost_mas = time_source_cost(uint64_t{on_s} * kGpsActiveCurrentMa,
+                                       stats.attempts, stats.failures),
+          .error_us = kDriftSyncErrorUs,
+          .gives_position = true};
+}
+
+inline TimeSourceOption time_source_sntp_option(const SntpStats &stats,
+                                                int64_t now, bool configured) {
+  const uint32_t successes = stats.attempts - stats.failures;
+  const uint32_t radio_ms =
+      successes > 0 ? stats.radio_ms_sum / successes : kSntpDefaultRadioMs;
+  return {.source = TimeSource::kSntp,
+          .available = configured && sntp_attempt_due(stats, now),
+          .cost_mas = time_source_cost(
+              uint64_t{radio_ms} * kWifiActiveCurrentMa / 1000,
+              stats.attempts, stats.failures),
+          // Half the round trip, the asymmetry can't be told apart
+          .error_us = stats.last_delay_us / 2,
+          .gives_position = false};
+}
+
+// The cheapest available source accurate enough for the drift target.
+// Without a known position for the timezone one that gives it comes first.
+inline TimeSource time_source_select(const TimeSourceOption *options,
+                                     size_t count, bool need_position) {
+  const TimeSourceOption *best = nullptr;
+  for (size_t i = 0; i < count; i++) {
+    const TimeSourceOption &option = options[i];
+    if (!option.available ||
+        option.error_us > kDriftTargetErrorUs / kTimeSourceErrorFraction) {
+      continue;
+    }
+    if (best == nullptr ||
+        (need_position && option.gives_position && !best->gives_position) ||
+        ((!need_position || option.gives_position == best->gives_position) &&
+         option.cost_mas < best->cost_mas)) {
+      best = &option;
+    }
+  }
+  return best != nullptr ? best->source : TimeSource::kNone;
+}
+
+// Earliest UTC second any configured source may be tried again, 0 if one
+// is due already
+inline int64_t time_source_next_attempt(const GpsAttemptStats &gps,
+                                        const SntpStats &sntp, int64_t now,
+                                        bool sntp_configured) {
+  if (gps_attempt_due(gps, now) ||
+      (sntp_configured && sntp_attempt_due(sntp, now))) {
+    return 0;
+  }
+  if (sntp_configured && sntp.next_attempt_time < gps.next_attempt_time) {
+    return sntp.next_attempt_time;
+  }
+  return gps.next_attempt_time;
+}
+
+inline const char *time_source_name(TimeSource source) {
+  switch (source) {
+  case TimeSource::kNone:
+    return "none";
+  case TimeSource::kGps:
+    return "GPS";
+  case TimeSource::kSntp:
+    return "SNTP";
+  }
+  return "?";
+}
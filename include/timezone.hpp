@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+
+#include "esp_err.h"
+
+// Partition holding the index from tools/tz_index_gen.py
+static constexpr const char *kTzPartitionLabel = "spiffs";
+
+// Looks the position up in the timezone index and switches TZ to the
+// zone's rules. The index is mapped from flash for the lookup, nothing gets
+// mounted or copied. Keeps the current TZ if there is no index or the
+// position isn't in it.
+esp_err_t timezone_apply_position(int32_t latitude_e7, int32_t longitude_e7);
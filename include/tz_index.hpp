@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Timezone index as written by tools/tz_index_gen.py, all little endian:
+//
+//   header   magic "TZQ1", version, zone count, grid columns and rows,
+//            offsets of the sections below, total size
+//   grid     columns * rows node refs, row 0 at the south pole, column 0
+//            at 180 W
+//   nodes    4 node refs each, for the SW, SE, NW and NE quarter
+//   zones    one offset per zone to "name\0posix TZ\0"
+//
+// A node ref with kTzRefLeaf set is a leaf, its low 16 bits are the zone.
+// Otherwise it is the index of the node that splits the area further. The
+// index may sit at the start of a larger partition, the header's size
+// tells where it ends.
+static constexpr uint32_t kTzIndexMagic = 0x31515a54; // "TZQ1"
+static constexpr uint16_t kTzIndexVersion = 1;
+static constexpr size_t kTzIndexHeaderSize = 32;
+static constexpr uint32_t kTzRefLeaf = 0x80000000;
+// Nothing deeper than this gets generated, also bounds a corrupt index
+static constexpr int kTzIndexMaxDepth = 12;
+static constexpr uint16_t kTzZoneNone = 0xffff;
+
+// Read-only view on an index, typically memory mapped from flash. Lookups
+// only touch the few words on their path and keep nothing in RAM.
+class TzIndex {
+public:
+  TzIndex(const uint8_t *data, size_t size) : m_data(data), m_size(size) {
+    m_valid = size >= kTzIndexHeaderSize && u32(0) == kTzIndexMagic &&
+              u16(4) == kTzIndexVersion && u32(28) <= size;
+    if (!m_valid) {
+      return;
+    }
+    m_size = u32(28);
+    m_zone_count = u16(6);
+    m_columns = u16(8);
+    m_rows = u16(10);
+    m_grid_offset = u32(12);
+    m_node_offset = u32(16);
+    m_node_count = u32(20);
+    m_zone_offset = u32(24);
+    m_valid = m_columns > 0 && m_rows > 0 &&
+              fits(m_grid_offset, uint64_t{m_columns} * m_rows * 4) &&
+              fits(m_node_offset, uint64_t{m_node_count} * 16) &&
+              fits(m_zone_offset, uint64_t{m_zone_count} * 4);
+  }
+
+  // Total size of the index starting with `header`, of which only the
+  // first kTzIndexHeaderSize bytes are read. 0 if it isn't one. Tells how
+  // much of a partition to map.
+  static size_t size_in_header(const uint8_t *header) {
+    // The sections only get checked against the size the header states
+    return TzIndex(header, SIZE_MAX).size();
+  }
+
+  bool valid() const { return m_valid; }
+  uint16_t zone_count() const { return m_valid ? m_zone_count : 0; }
+  size_t size() const { return m_valid ? m_size : 0; }
+
+  // The zone at a position in degrees * 1e7, kTzZoneNone if unknown.
+  // `depth` gets the number of nodes visited below the grid.
+  uint16_t lookup(int32_t latitude_e7, int32_t longitude_e7,
+                  int *depth = nullptr) const {
+    if (depth != nullptr) {
+      *depth = 0;
+    }
+    if (!m_valid) {
+      return kTzZoneNone;
+    }
+    // Offsets from the SW corner of the world, in 1e-7 degrees
+    const uint32_t x = clamp(int64_t{longitude_e7} + 1800000000, 3600000000);
+    const uint32_t y = clamp(int64_t{latitude_e7} + 900000000, 1800000000);
+    uint32_t cell_w = 3600000000u / m_columns;
+    uint32_t cell_h = 1800000000u / m_rows;
+    const uint32_t column = min_u32(x / cell_w, m_columns - 1);
+    const uint32_t row = min_u32(y / cell_h, m_rows - 1);
+    uint32_t cx = x - column * cell_w;
+    uint32_t cy = y - row * cell_h;
+
+    uint32_t ref = u32(m_grid_offset + (row * m_columns + column) * 4);
+    for (int level = 0; (ref & kTzRefLeaf) == 0; level++) {
+      if (level == kTzIndexMaxDepth || ref >= m_node_count) {
+        return kTzZoneNone;
+      }
+      cell_w /= 2;
+      cell_h /= 2;
+      int quarter = 0;
+      if (cx >= cell_w) {
+        quarter |= 1;
+        cx -= cell_w;
+      }
+      if (cy >= cell_h) {
+        quarter |= 2;
+        cy -= cell_h;
+      }
+      ref = u32(m_node_offset + ref * 16 + quarter * 4);
+      if (depth != nullptr) {
+        *depth = level + 1;
+      }
+    }
+    const uint16_t zone = ref & 0xffff;
+    return zone < m_zone_count ? zone : kTzZoneNone;
+  }
+
+  // IANA name and POSIX TZ string of a zone, nullptr if out of range
+  const char *name(uint16_t zone) const { return zone_string(zone, 0); }
+  const char *posix(uint16_t zone) const { return zone_string(zone, 1); }
+
+private:
+  uint16_t u16(size_t offset) const {
+    return m_data[offset] | (m_data[offset + 1] << 8);
+  }
+
+  uint32_t u32(size_t offset) const {
+    return m_data[offset] | (m_data[offset + 1] << 8) |
+           (m_data[offset + 2] << 16) |
+           (static_cast<uint32_t>(m_data[offset + 3]) << 24);
+  }
+
+  bool fits(uint32_t offset, uint64_t length) const {
+    return offset >= kTzIndexHeaderSize && offset + length <= m_size;
+  }
+
+  static uint32_t clamp(int64_t v, int64_t max) {
+    return static_cast<uint32_t>(v < 0 ? 0 : v > max ? max : v);
+  }
+
+  static uint32_t min_u32(uint32_t a, uint32_t b) { return a < b ? a : b; }
+
+  // The `index`th string of the zone's record, checked to end in the index
+  const char *zone_string(uint16_t zone, int index) const {
+    if (zone >= zone_count()) {
+      return nullptr;
+    }
+    size_t offset = u32(m_zone_offset + zone * 4);
+    for (int i = 0; offset < m_size; i++) {
+      const char *s = reinterpret_cast<const char *>(m_data + offset);
+      const size_t length = strnlen(s, m_size - offset);
+      if (offset + length == m_size) {
+        return nullptr;
+      }
+      if (i == index) {
+        return s;
+      }
+      offset += length + 1;
+    }
+    return nullptr;
+  }
+
+  const uint8_t *m_data;
+  size_t m_size;
+  bool m_valid;
+  uint16_t m_zone_count = 0;
+  uint16_t m_columns = 0;
+  uint16_t m_rows = 0;
+  uint32_t m_grid_offset = 0;
+  uint32_t m_node_offset = 0;
+  uint32_t m_node_count = 0;
+  uint32_t m_zone_offset = 0;
+};
@@ -1,148 +1,36 @@
 #include "driver/uart.h"
 #include "esp_log.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
 #include "freertos/task.h"
-#include "nvs.h"
-#include "nvs_flash.h"
-#include <iostream>
 #include <optional>
-#include <sstream>
-#include <string>
-#include <vector>
 
-#define GPS_POWER_PIN GPIO_NUM_2
-
-// Struct to hold GPRMC data
-struct GPRMCData {
-  tm timeinfo;
-  std::string status;
-  double latitude;
-  double longitude;
-};
-
-// Struct to hold GPGLL data
-struct GPGLLData {
-  tm timeinfo;
-  double latitude;
-  double longitude;
-  std::string validity;
-};
-
-// Function to split a string by a delimiter into a vector
-std::vector<std::string> split(const std::string &s, char delimiter) {
-  std::vector<std::string> tokens;
-  std::string token;
-  std::istringstream tokenStream(s);
-  while (std::getline(tokenStream, token, delimiter)) {
-    tokens.push_back(token);
-  }
-  return tokens;
-}
-
-// Function to parse a GPRMC GPS sentence
-std::optional<GPRMCData> parseGPRMC(const std::string &gprmc) {
-  GPRMCData data = {0};
-
-  if (gprmc.find("$GPRMC") != 0 || gprmc.empty()) {
-    return std::nullopt; // Not a valid GPRMC sentence
-  }
-
-  std::vector<std::string> tokens = split(gprmc, ',');
-  if (tokens.size() < 12) {
-    return std::nullopt; // Not enough data
-  }
-
-  // Parse time
-  std::string timeStr = tokens[1];
-  std::string dateStr = tokens[9];
-  if (timeStr.length() >= 6 && dateStr.length() == 6) {
-    data.timeinfo.tm_hour = std::stoi(timeStr.substr(0, 2));
-    data.timeinfo.tm_min = std::stoi(timeStr.substr(2, 2));
-    data.timeinfo.tm_sec = std::stoi(timeStr.substr(4, 2));
-
-    // Parse date
-    data.timeinfo.tm_mday = std::stoi(dateStr.substr(0, 2));
-    data.timeinfo.tm_mon =
-        std::stoi(dateStr.substr(2, 2)) - 1; // months since January
-    data.timeinfo.tm_year =
-        std::stoi(dateStr.substr(4, 2)) + 100; // years since 1900
-  } else {
-    return std::nullopt; // Invalid time or date format
-  }
+#include "gps_control.hpp"
+#include "gps_reader.hpp"
+#include "gps_timing.hpp"
+#include "nmea.hpp"
+#include "nmea_time.hpp"
+#include "persistent_state.hpp"
+#include "ubx.hpp"
+#include "utc_sequence.hpp"
 
-  // Parse status
-  data.status = tokens[2];
-
-  // Parse latitude and longitude
-  std::string lat = tokens[3];
-  std::string latDir = tokens[4];
-  std::string lon = tokens[5];
-  std::string lonDir = tokens[6];
-  if (!lat.empty() && !lon.empty() && latDir.length() == 1 &&
-      lonDir.length() == 1) {
-    double latDeg = std::stod(lat.substr(0, 2));
-    double latMin = std::stod(lat.substr(2));
-    data.latitude = latDeg + (latMin / 60.0);
-    data.latitude *= (latDir[0] == 'N') ? 1 : -1;
-
-    double lonDeg = std::stod(lon.substr(0, 3));
-    double lonMin = std::stod(lon.substr(3));
-    data.longitude = lonDeg + (lonMin / 60.0);
-    data.longitude *= (lonDir[0] == 'E') ? 1 : -1;
-  } else {
-    return std::nullopt; // Invalid latitude or longitude format
-  }
-
-  return data;
-}
-
-// Function to parse a GPGLL GPS sentence
-std::optional<GPGLLData> parseGPGLL(const std::string &sentence) {
-  GPGLLData data;
-
-  size_t gpgllPos = sentence.find("$GPGLL");
-  if (gpgllPos == std::string::npos) {
-    return std::nullopt; // GPGLL not found
-  }
-
-  // Extract substring from GPGLL to the end
-  std::string gpgll = sentence.substr(gpgllPos);
-  ESP_LOGI("UART", "yay");
-
-  std::vector<std::string> tokens = split(gpgll, ',');
-  if (tokens.size() < 7) {
-    return std::nullopt; // Not enough data
-  }
-
-  // Parse UTC time
-  std::string timeStr = tokens[5];
-  if (timeStr.length() >= 6) {
-    data.timeinfo = tm(); // Initialize to zero
-    data.timeinfo.tm_hour = std::stoi(timeStr.substr(0, 2));
-    data.timeinfo.tm_min = std::stoi(timeStr.substr(2, 2));
-    data.timeinfo.tm_sec = std::stoi(timeStr.substr(4, 2));
-  } else {
-    return std::nullopt; // Invalid time format
-  }
-  ESP_LOGI("UART", "yay5");
+#define GPS_POWER_PIN GPIO_NUM_2
+// The receiver's timepulse output, GPIO_NUM_NC if it isn't wired up
+#define GPS_PPS_PIN GPIO_NUM_NC
 
-  return data;
-}
+static constexpr int kGpsUartRxBufferSize = 1024 * 2;
+static constexpr int kGpsUartEventQueueLength = 20;
+// Each '\n' seen by the UART ISR records its position in the RX ring buffer
+static constexpr int kGpsUartPatternQueueLength = 16;
 
-void set_time(GPRMCData &gps_data) {
-  // Convert to epoch time (seconds since 1970-01-01 00:00:00 UTC)
-  time_t t = mktime(&gps_data.timeinfo);
-  // Set system time
-  struct timeval now = {.tv_sec = t};
-  settimeofday(&now, NULL);
-}
+static QueueHandle_t gps_uart_queue = nullptr;
 
-void set_time(GPGLLData &gps_data) {
-  // Convert to epoch time (seconds since 1970-01-01 00:00:00 UTC)
-  time_t t = mktime(&gps_data.timeinfo);
-  // Set system time
-  struct timeval now = {.tv_sec = t};
+// Sets the system clock, microseconds included
+void set_time(int64_t utc_us) {
+  timeval now = {.tv_sec = static_cast<time_t>(utc_us / 1000000),
+                 .tv_usec = static_cast<suseconds_t>(utc_us % 1000000)};
   settimeofday(&now, NULL);
 }
 
@@ -156,95 +44,114 @@ void setup_gpio_out() {
   gpio_config(&config);
 }
 
-void uart_init() {
-  ESP_LOGI("UART", "uart_init");
+// Installs the UART driver for the receiver. Only done while the GPS is
+// powered, the driver's interrupt and buffers are released again by
+// gps_uart_uninstall().
+esp_err_t gps_uart_install(uint32_t baud_rate) {
+  ESP_LOGI("UART", "gps_uart_install");
 
-  uart_config_t uart_config = {.baud_rate = 9600,
+  uart_config_t uart_config = {.baud_rate = static_cast<int>(baud_rate),
                                .data_bits = UART_DATA_8_BITS,
                                .parity = UART_PARITY_DISABLE,
                                .stop_bits = UART_STOP_BITS_1,
                                .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
-                               .rx_flow_ctrl_thresh = 0};
+                               .rx_flow_ctrl_thresh = 0,
+                               // REF_TICK keeps its 1 MHz under DFS, the
+                               // baud rate doesn't move with the APB clock
+                               .source_clk = UART_SCLK_REF_TICK};
 
   uart_param_config(UART_NUM_1, &uart_config);
 
-  uart_driver_install(UART_NUM_1, 1024 * 2, 0, 0, NULL, 0);
+  const esp_err_t err =
+      uart_driver_install(UART_NUM_1, kGpsUartRxBufferSize, 0,
+                          kGpsUartEventQueueLength, &gps_uart_queue, 0);
+  if (err != ESP_OK) {
+    return err;
+  }
   uart_set_pin(UART_NUM_1, GPIO_NUM_4, GPIO_NUM_5, UART_PIN_NO_CHANGE,
                UART_PIN_NO_CHANGE);
 
-  setup_gpio_out();
-}
-
-esp_err_t save_event_time_to_nvs(const char *key, time_t event_time) {
-  nvs_handle_t my_handle;
-  esp_err_t err;
-
-  // Open
-  err = nvs_open("storage", NVS_READWRITE, &my_handle);
-  if (err != ESP_OK)
-    return err;
-
-  // Write
-  err = nvs_set_i64(my_handle, key, (int64_t)event_time);
-  if (err != ESP_OK)
-    return err;
-
-  // Commit written value.
-  err = nvs_commit(my_handle);
-  if (err != ESP_OK)
-    return err;
-
-  // Close
-  nvs_close(my_handle);
+  // Let the driver frame NMEA lines for us: every '\n' raises a
+  // UART_PATTERN_DET event, so the reader task only wakes up for complete
+  // lines.
+  uart_enable_pattern_det_baud_intr(UART_NUM_1, '\n', 1, kGpsPatternGapBits,
+                                    kGpsPatternPostIdleBits, 0);
+  uart_pattern_queue_reset(UART_NUM_1, kGpsUartPatternQueueLength);
   return ESP_OK;
 }
 
-esp_err_t read_event_time_from_nvs(const char *key, time_t *event_time) {
-  nvs_handle_t my_handle;
-  esp_err_t err;
-
-  // Open
-  err = nvs_open("storage", NVS_READWRITE, &my_handle);
-  if (err != ESP_OK)
-    return err;
+void gps_uart_uninstall() {
+  if (uart_is_driver_installed(UART_NUM_1)) {
+    uart_driver_delete(UART_NUM_1);
+  }
+  gps_uart_queue = nullptr;
+}
 
-  // Read
-  int64_t stored_time = 0; // Variable to store the read value
-  err = nvs_get_i64(my_handle, key, &stored_time);
-  if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND)
-    return err;
+// Sets the clock to a time that passed validity gating, once `sequence`
+// confirms it. `gps_us` is the UTC of the epoch `timing` located, the clock
+// gets it plus what passed since. Returns whether it did.
+bool accept_gps_time(UtcSequenceCheck &sequence, const GpsEpochTiming &timing,
+                     int64_t gps_us, SyncQuality quality, const char *source) {
+  if (!sequence.confirm(gps_us, timing.epoch_us())) {
+    return false;
+  }
+  timeval local;
+  gettimeofday(&local, NULL);
+  const int64_t local_us = local.tv_sec * 1000000LL + local.tv_usec;
+  const int64_t now_us = gps_utc_now_us(gps_us, timing.epoch_us(),
+                                        timing.pps_locked(),
+                                        esp_timer_get_time());
+  set_time(now_us);
+  persistent_state_record_sync(now_us, local_us, quality);
+  ESP_LOGI("UART_TASK", "%s time %lld recorded%s, local offset %lld us",
+           source, static_cast<long long>(gps_us / 1000000),
+           timing.pps_locked() ? " on PPS" : "",
+           static_cast<long long>(local_us - now_us));
+  return true;
+}
 
-  *event_time = (time_t)stored_time;
+// Sets the clock from sentences with a fix, whatever sentence and talker
+// they come in (see nmea_reading_utc_us()). Returns whether it did.
+bool handle_nmea_sentence(const NmeaSentence &sentence,
+                          UtcSequenceCheck &sequence,
+                          const GpsEpochTiming &timing) {
+  const auto reading = nmea_read_time(sentence);
+  if (!reading) {
+    return false;
+  }
 
-  // Close
-  nvs_close(my_handle);
-  return ESP_OK;
+  timeval local;
+  gettimeofday(&local, NULL);
+  const int64_t local_us = local.tv_sec * 1000000LL + local.tv_usec;
+  const bool local_valid =
+      local.tv_sec >= utc_seconds(kNmeaMinPlausibleYear, 1, 1, 0, 0, 0);
+  const auto gps_us = nmea_reading_utc_us(*reading, local_us, local_valid);
+  if (!gps_us ||
+      !accept_gps_time(sequence, timing, *gps_us, SyncQuality::kFix,
+                       sentence.field(0))) {
+    return false;
+  }
+  if (reading->has_position) {
+    persistent_state_record_position(*gps_us / 1000000, reading->latitude_e7,
+                                     reading->longitude_e7);
+  }
+  return true;
 }
 
-void uart_task(void *pvParameters) {
-  const int uart_num = UART_NUM_1;
-  uint8_t data[1024];
-  while (1) {
-    int len =
-        uart_read_bytes(uart_num, data, sizeof(data), 20 / portTICK_PERIOD_MS);
-    if (len > 0) {
-      data[len] = 0; // Null-terminate the data
-      ESP_LOGI("UART", "Received data: %s", data);
-      auto parsed_data =
-          parseGPRMC(std::string{reinterpret_cast<char *>(data)});
-      // auto parsed_data =
-      //     parseGPGLL(std::string{reinterpret_cast<char *>(data)});
-      if (parsed_data) {
-        printTimeInfo(parsed_data->timeinfo);
-        set_time(*parsed_data);
-        time_t save_time = mktime(&parsed_data->timeinfo);
-        ESP_ERROR_CHECK(save_event_time_to_nvs("gps_time", save_time));
-        ESP_LOGI("UART_TASK", "Event time %lld saved", save_time);
-      }
-    } else {
-      ESP_LOGE("UART", "Failed to parse GPRMC sentence.");
-    }
+// UBX frames are either answers to our commands, or with kGpsTimeOnly the
+// receiver's UTC. Only UTC flagged valid, leap seconds included, and with
+// a small enough accuracy estimate is taken. Returns whether it set the
+// clock.
+bool handle_ubx_frame(const UbxFrame &frame, UtcSequenceCheck &sequence,
+                      const GpsEpochTiming &timing) {
+  UbxNavTimeutc timeutc;
+  if (!ubx_parse_nav_timeutc(frame, timeutc)) {
+    gps_control_on_frame(frame);
+    return false;
   }
+  return kGpsTimeOnly && ubx_nav_timeutc_usable(timeutc) &&
+         accept_gps_time(sequence, timing, timeutc.utc_us,
+                         SyncQuality::kUtcValid, "NAV-TIMEUTC");
 }
 
 void power_down_gps() {
@@ -253,4 +160,4 @@ void power_down_gps() {
 
 void power_up_gps() {
   gpio_set_level(GPS_POWER_PIN, 1); // Set to 1 to turn on the GPS module
-}
\ No newline at end of file
+}
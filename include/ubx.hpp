@@ -0,0 +1,317 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "civil_time.hpp"
+#include "drift_model.hpp"
+
+// u-blox binary protocol: sync chars, class, id, little endian length,
+// payload and an 8 bit Fletcher checksum over everything but the sync.
+static constexpr uint8_t kUbxSync1 = 0xb5;
+static constexpr uint8_t kUbxSync2 = 0x62;
+static constexpr size_t kUbxFrameOverhead = 8;
+// Longer frames than anything we consume are skipped
+static constexpr size_t kUbxMaxPayload = 64;
+
+static constexpr uint8_t kUbxClassNav = 0x01;
+static constexpr uint8_t kUbxClassRxm = 0x02;
+static constexpr uint8_t kUbxClassAck = 0x05;
+static constexpr uint8_t kUbxClassCfg = 0x06;
+static constexpr uint8_t kUbxClassAid = 0x0b;
+
+static constexpr uint8_t kUbxIdAckNak = 0x00;
+static constexpr uint8_t kUbxIdAckAck = 0x01;
+static constexpr uint8_t kUbxIdRxmPmreq = 0x41;
+static constexpr uint8_t kUbxIdNavTimeutc = 0x21;
+static constexpr uint8_t kUbxIdAidIni = 0x01;
+static constexpr uint8_t kUbxIdCfgPrt = 0x00;
+static constexpr uint8_t kUbxIdCfgMsg = 0x01;
+static constexpr uint8_t kUbxIdCfgRate = 0x08;
+
+// Standard NMEA sentences are messages of class 0xf0 to CFG-MSG
+static constexpr uint8_t kUbxClassNmea = 0xf0;
+static constexpr uint8_t kUbxIdNmeaGga = 0x00;
+static constexpr uint8_t kUbxIdNmeaGll = 0x01;
+static constexpr uint8_t kUbxIdNmeaGsa = 0x02;
+static constexpr uint8_t kUbxIdNmeaGsv = 0x03;
+static constexpr uint8_t kUbxIdNmeaRmc = 0x04;
+static constexpr uint8_t kUbxIdNmeaVtg = 0x05;
+static constexpr uint8_t kUbxIdNmeaZda = 0x08;
+
+// GPS time started 1980-01-06 and ignores leap seconds, UTC is behind by
+// the leap seconds inserted since
+static constexpr int64_t kGpsEpochUnix = 315964800;
+static constexpr int64_t kGpsUtcLeapSeconds = 18;
+static constexpr int64_t kGpsWeekS = 7 * 24 * 3600;
+
+struct UbxFrame {
+  uint8_t cls;
+  uint8_t id;
+  uint16_t length;
+  uint8_t payload[kUbxMaxPayload];
+};
+
+inline void ubx_put_u16(uint8_t *p, uint16_t v) {
+  p[0] = v & 0xff;
+  p[1] = v >> 8;
+}
+
+inline void ubx_put_u32(uint8_t *p, uint32_t v) {
+  for (int i = 0; i < 4; i++) {
+    p[i] = (v >> (8 * i)) & 0xff;
+  }
+}
+
+inline uint16_t ubx_get_u16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+inline uint32_t ubx_get_u32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) |
+         (static_cast<uint32_t>(p[3]) << 24);
+}
+
+// Writes the whole frame to `out`, which needs room for
+// `length` + kUbxFrameOverhead bytes. Returns the frame size.
+inline size_t ubx_frame(uint8_t cls, uint8_t id, const uint8_t *payload,
+                        uint16_t length, uint8_t *out) {
+  out[0] = kUbxSync1;
+  out[1] = kUbxSync2;
+  out[2] = cls;
+  out[3] = id;
+  ubx_put_u16(out + 4, length);
+  for (uint16_t i = 0; i < length; i++) {
+    out[6 + i] = payload[i];
+  }
+  uint8_t ck_a = 0;
+  uint8_t ck_b = 0;
+  for (size_t i = 2; i < 6u + length; i++) {
+    ck_a += out[i];
+    ck_b += ck_a;
+  }
+  out[6 + length] = ck_a;
+  out[7 + length] = ck_b;
+  return length + kUbxFrameOverhead;
+}
+
+// Picks UBX frames out of a byte stream that is mostly NMEA text
+class UbxParser {
+public:
+  // Returns true once a frame with a valid checksum is complete
+  bool feed(uint8_t c) {
+    switch (m_state) {
+    case State::kSync1:
+      if (c == kUbxSync1) {
+        m_state = State::kSync2;
+      }
+      return false;
+    case State::kSync2:
+      m_state = c == kUbxSync2 ? State::kClass : State::kSync1;
+      return false;
+    case State::kClass:
+      m_frame.cls = c;
+      m_ck_a = m_ck_b = 0;
+      checksum(c);
+      m_state = State::kId;
+      return false;
+    case State::kId:
+      m_frame.id = c;
+      checksum(c);
+      m_state = State::kLength1;
+      return false;
+    case State::kLength1:
+      m_frame.length = c;
+      checksum(c);
+      m_state = State::kLength2;
+      return false;
+    case State::kLength2:
+      m_frame.length |= c << 8;
+      checksum(c);
+      m_received = 0;
+      if (m_frame.length > kUbxMaxPayload) {
+        m_state = State::kSync1;
+      } else {
+        m_state = m_frame.length > 0 ? State::kPayload : State::kCkA;
+      }
+      return false;
+    case State::kPayload:
+      m_frame.payload[m_received++] = c;
+      checksum(c);
+      if (m_received == m_frame.length) {
+        m_state = State::kCkA;
+      }
+      return false;
+    case State::kCkA:
+      if (c != m_ck_a) {
+        m_checksum_errors++;
+        m_state = State::kSync1;
+        return false;
+      }
+      m_state = State::kCkB;
+      return false;
+    case State::kCkB:
+      m_state = State::kSync1;
+      if (c != m_ck_b) {
+        m_checksum_errors++;
+        return false;
+      }
+      return true;
+    }
+    return false;
+  }
+
+  const UbxFrame &frame() const { return m_frame; }
+  // Past the sync characters of a frame
+  bool in_frame() const {
+    return m_state != State::kSync1 && m_state != State::kSync2;
+  }
+  uint32_t checksum_errors() const { return m_checksum_errors; }
+
+private:
+  enum class State : uint8_t {
+    kSync1,
+    kSync2,
+    kClass,
+    kId,
+    kLength1,
+    kLength2,
+    kPayload,
+    kCkA,
+    kCkB,
+  };
+
+  void checksum(uint8_t c) {
+    m_ck_a += c;
+    m_ck_b += m_ck_a;
+  }
+
+  UbxFrame m_frame = {};
+  State m_state = State::kSync1;
+  uint16_t m_received = 0;
+  uint8_t m_ck_a = 0;
+  uint8_t m_ck_b = 0;
+  uint32_t m_checksum_errors = 0;
+};
+
+// RXM-PMREQ: enter backup until woken up by activity on the RX line
+static constexpr size_t kUbxRxmPmreqLength = 8;
+inline void ubx_rxm_pmreq_backup(uint8_t *payload) {
+  ubx_put_u32(payload, 0);      // duration: until woken up
+  ubx_put_u32(payload + 4, 2); // flags: backup
+}
+
+// CFG-MSG, short form: output `rate` per navigation solution on the port
+// the command came in on, 0 disables the message
+static constexpr size_t kUbxCfgMsgLength = 3;
+inline void ubx_cfg_msg(uint8_t cls, uint8_t id, uint8_t rate,
+                        uint8_t *payload) {
+  payload[0] = cls;
+  payload[1] = id;
+  payload[2] = rate;
+}
+
+// CFG-RATE: one measurement every `meas_rate_ms`, a solution for each,
+// aligned to GPS time
+static constexpr size_t kUbxCfgRateLength = 6;
+inline void ubx_cfg_rate(uint16_t meas_rate_ms, uint8_t *payload) {
+  ubx_put_u16(payload, meas_rate_ms);
+  ubx_put_u16(payload + 2, 1);
+  ubx_put_u16(payload + 4, 1);
+}
+
+// CFG-PRT for UART1: 8N1 at `baud_rate`, UBX and NMEA in both directions
+static constexpr size_t kUbxCfgPrtLength = 20;
+inline void ubx_cfg_prt_uart(uint32_t baud_rate, uint8_t *payload) {
+  static constexpr uint32_t kMode8N1 = 0x08d0;
+  static constexpr uint16_t kProtoUbxNmea = 0x03;
+  for (size_t i = 0; i < kUbxCfgPrtLength; i++) {
+    payload[i] = 0;
+  }
+  payload[0] = 1; // UART1
+  ubx_put_u32(payload + 4, kMode8N1);
+  ubx_put_u32(payload + 8, baud_rate);
+  ubx_put_u16(payload + 12, kProtoUbxNmea);
+  ubx_put_u16(payload + 14, kProtoUbxNmea);
+}
+
+// NAV-TIMEUTC: UTC of a navigation epoch and how far to trust it
+static constexpr size_t kUbxNavTimeutcLength = 20;
+static constexpr uint8_t kUbxTimeutcValidTow = 0x01;
+static constexpr uint8_t kUbxTimeutcValidWkn = 0x02;
+// Leap seconds are known, so UTC is UTC and not GPS time minus a default
+static constexpr uint8_t kUbxTimeutcValidUtc = 0x04;
+// validUTC alone isn't enough: after a backup wake the receiver reports the
+// time of its own RTC before tracking anything, with an accuracy estimate
+// of milliseconds to seconds. A tenth of the error the drift model assumes
+// for a sync keeps those out, a tracking receiver is at tens of ns.
+static constexpr uint32_t kUbxTimeutcMaxAccuracyNs =
+    kDriftSyncErrorUs * 1000 / 10;
+
+struct UbxNavTimeutc {
+  int64_t utc_us;
+  uint32_t accuracy_ns;
+  uint8_t valid; // kUbxTimeutcValid* flags
+};
+
+inline bool ubx_parse_nav_timeutc(const UbxFrame &frame, UbxNavTimeutc &out) {
+  if (frame.cls != kUbxClassNav || frame.id != kUbxIdNavTimeutc ||
+      frame.length != kUbxNavTimeutcLength) {
+    return false;
+  }
+  const uint8_t *p = frame.payload;
+  out.accuracy_ns = ubx_get_u32(p + 4);
+  // Signed, the second fields are rounded to the nearest second
+  const int32_t nano = static_cast<int32_t>(ubx_get_u32(p + 8));
+  out.utc_us = utc_seconds(ubx_get_u16(p + 12), p[14], p[15], p[16], p[17],
+                           p[18]) *
+                   1000000 +
+               nano / 1000;
+  out.valid = p[19];
+  return true;
+}
+
+// Whether the UTC of `timeutc` is good enough to set the clock from
+inline bool ubx_nav_timeutc_usable(const UbxNavTimeutc &timeutc) {
+  return (timeutc.valid & kUbxTimeutcValidUtc) != 0 &&
+         timeutc.accuracy_ns < kUbxTimeutcMaxAccuracyNs;
+}
+
+// What the receiver is told on startup to skip the search
+struct GpsAiding {
+  bool position_valid;
+  int32_t latitude_e7;
+  int32_t longitude_e7;
+  uint32_t position_accuracy_cm;
+  bool time_valid;
+  int64_t utc_us;
+  uint32_t time_accuracy_ms;
+};
+
+// AID-INI, position as lat/lon without altitude, time as GPS week and
+// time of week
+static constexpr size_t kUbxAidIniLength = 48;
+inline void ubx_aid_ini(const GpsAiding &aiding, uint8_t *payload) {
+  static constexpr uint32_t kFlagPosition = 0x01;
+  static constexpr uint32_t kFlagTime = 0x02;
+  static constexpr uint32_t kFlagLatLon = 0x20;
+  static constexpr uint32_t kFlagAltitudeInvalid = 0x40;
+
+  for (size_t i = 0; i < kUbxAidIniLength; i++) {
+    payload[i] = 0;
+  }
+  uint32_t flags = 0;
+  if (aiding.position_valid) {
+    ubx_put_u32(payload, aiding.latitude_e7);
+    ubx_put_u32(payload + 4, aiding.longitude_e7);
+    ubx_put_u32(payload + 12, aiding.position_accuracy_cm);
+    flags |= kFlagPosition | kFlagLatLon | kFlagAltitudeInvalid;
+  }
+  if (aiding.time_valid) {
+    const int64_t gps_ms = (aiding.utc_us / 1000) -
+                           (kGpsEpochUnix - kGpsUtcLeapSeconds) * 1000;
+    ubx_put_u16(payload + 18, gps_ms / (kGpsWeekS * 1000));
+    ubx_put_u32(payload + 20, gps_ms % (kGpsWeekS * 1000));
+    ubx_put_u32(payload + 28, aiding.time_accuracy_ms);
+    flags |= kFlagTime;
+  }
+  ubx_put_u32(payload + 44, flags);
+}
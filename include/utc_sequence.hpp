@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+
+// How far the step between two GPS times may differ from what the local
+// monotonic clock saw. Covers sentence transmission and handling latency.
+static constexpr int64_t kUtcSequenceToleranceUs = 250 * 1000;
+// Times closer together than this are from the same epoch: RMC and
+// NAV-TIMEUTC report it a few microseconds to milliseconds apart. Half of
+// the shortest measurement period, the receiver's default of 1 s.
+static constexpr int64_t kUtcSequenceMinStepUs = 500 * 1000;
+
+// A single valid-looking timestamp never sets the clock: it has to be
+// confirmed by one of a later epoch, which must be ahead by as much as the
+// monotonic clock went on in between. Times before `not_before_us` (the
+// last GPS sync) are rejected outright.
+class UtcSequenceCheck {
+public:
+  explicit UtcSequenceCheck(int64_t not_before_us)
+      : m_not_before_us(not_before_us) {}
+
+  // Feeds a time that passed validity gating, received at `mono_us`.
+  // Returns true if it confirms the previous one.
+  bool confirm(int64_t utc_us, int64_t mono_us) {
+    if (utc_us < m_not_before_us) {
+      m_rejected++;
+      return false;
+    }
+    if (m_has_previous &&
+        std::llabs(utc_us - m_utc_us) < kUtcSequenceMinStepUs) {
+      // Another message of the same epoch, keep the first arrival
+      return false;
+    }
+    const bool confirmed =
+        m_has_previous && utc_us > m_utc_us &&
+        std::llabs((utc_us - m_utc_us) - (mono_us - m_mono_us)) <=
+            kUtcSequenceToleranceUs;
+    if (m_has_previous && !confirmed) {
+      m_rejected++;
+    }
+    m_utc_us = utc_us;
+    m_mono_us = mono_us;
+    m_has_previous = true;
+    return confirmed;
+  }
+
+  uint32_t rejected() const { return m_rejected; }
+
+private:
+  int64_t m_not_before_us;
+  int64_t m_utc_us = 0;
+  int64_t m_mono_us = 0;
+  bool m_has_previous = false;
+  uint32_t m_rejected = 0;
+};
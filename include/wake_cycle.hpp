@@ -0,0 +1,170 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+
+#include <esp_log.h>
+
+#include "battery_model.hpp"
+#include "civil_time.hpp"
+#include "drift_model.hpp"
+#include "nightstand_layout.hpp"
+#include "persistent_state.hpp"
+#include "time_source.hpp"
+#include "wake_profiler.hpp"
+#include "wake_scheduler.hpp"
+
+// A system clock before this year was never set, it starts at the epoch
+static constexpr int32_t kWakeMinSyncedYear = 2023;
+
+// Everything a wake cycle touches outside the display. app_main wires
+// these to the ADCs, the system clock, GPS, Wi-Fi, NVS and FreeRTOS,
+// lumiere_sim to its simulated cell, sky and oscillator.
+struct WakeIo {
+  // Light sensor reading, 0..1 of full scale
+  std::function<float()> read_light;
+  // Reads the cell and returns the power policy for it. nullptr once the
+  // cell is empty and the clock goes to deep sleep instead.
+  std::function<const PowerPolicy *()> check_battery;
+
+  // The system clock in UTC microseconds, and stepping it
+  std::function<int64_t()> now_us;
+  std::function<void(int64_t utc_us)> set_time_us;
+  // UTC seconds to the local time shown
+  std::function<void(time_t utc, tm &local)> local_time;
+
+  // One sync attempt from either source. Both record the outcome, and a
+  // sync, in the persistent state. `first` is set while the clock was
+  // never synced.
+  std::function<void(bool first)> attempt_gps;
+  std::function<void()> attempt_sntp;
+  bool sntp_configured;
+
+  std::function<PersistentState()> state;
+  std::function<void(const PersistentState &state)> set_state;
+  // Writes the state through to NVS if it is due
+  std::function<void(time_t now)> commit;
+
+  // Light sleep until the next wake, the display keeps running
+  std::function<void(uint64_t sleep_us)> sleep;
+};
+
+// One pass through the main loop: light and battery, drift correction, a
+// time sync if one is due, the display and the sleep after it. Returns
+// false without sleeping if the cell is empty.
+inline bool wake_cycle(const WakeIo &io, ClockLeds &leds) {
+  const int64_t cycle_start_us = esp_timer_get_time();
+
+  float light;
+  {
+    ScopedPhase phase(WakePhase::kLightSensor);
+    light = io.read_light();
+    ESP_LOGI("LIGHT", "ADC Value: %f", light);
+  }
+
+  const PowerPolicy *policy;
+  {
+    ScopedPhase phase(WakePhase::kBattery);
+    policy = io.check_battery();
+  }
+  if (policy == nullptr) {
+    return false;
+  }
+  leds.set_max_light_scale(policy->max_light_scale);
+
+  time_t next_resync;
+  time_t now;
+  {
+    ScopedPhase phase(WakePhase::kTimeKeeping);
+    // Step the clock back by what the oscillator gained since the last
+    // wake. At a few hundred ppm that is well below a millisecond per
+    // minute, so the steps are invisible.
+    const int64_t local_us = io.now_us();
+    auto state = io.state();
+    const int64_t correction_us =
+        drift_model_take_correction(state.drift, local_us);
+    io.set_state(state);
+    if (correction_us != 0) {
+      io.set_time_us(local_us - correction_us);
+    }
+
+    next_resync = drift_model_next_resync(state.drift);
+    if (next_resync != 0) {
+      // A low battery stretches the interval the drift model asks for
+      const time_t anchor = state.drift.anchor_time_us / 1000000;
+      next_resync =
+          anchor + (next_resync - anchor) * policy->resync_interval_factor;
+    }
+    now = io.now_us() / 1000000;
+    ESP_LOGI("TIMESYNC", "now(%lld) - last_gps_time(%lld): %lld",
+             static_cast<long long>(now),
+             static_cast<long long>(state.last_sync_time),
+             static_cast<long long>(now - state.last_sync_time));
+    ESP_LOGI("TIMESYNC", "drift %ld ppb +/- %ld ppb, next resync in %lld s",
+             static_cast<long>(state.drift.drift_ppb),
+             static_cast<long>(state.drift.uncertainty_ppb),
+             static_cast<long long>(next_resync - now));
+  }
+
+  time_t deadline;
+  {
+    ScopedPhase phase(WakePhase::kTimeSync);
+    // Keep the drifting clock running instead of resetting it, the next
+    // sync measures how far it got off. After a failed attempt the
+    // display goes on with it until the backoff allows another one.
+    const bool never_synced =
+        now < utc_seconds(kWakeMinSyncedYear, 1, 1, 0, 0, 0);
+    if (never_synced || now >= next_resync) {
+      // The cheaper source that is good enough, GPS while the timezone
+      // still needs a position
+      const auto state = io.state();
+      const TimeSourceOption options[] = {
+          time_source_gps_option(state.gps, now),
+          time_source_sntp_option(state.sntp, now, io.sntp_configured)};
+      const TimeSource source =
+          time_source_select(options, 2, state.position.time == 0);
+      ESP_LOGI("TIMESYNC", "Syncing from %s (GPS %lu mAs, SNTP %lu mAs)",
+               time_source_name(source),
+               static_cast<unsigned long>(options[0].cost_mas),
+               static_cast<unsigned long>(options[1].cost_mas));
+      if (source == TimeSource::kGps) {
+        io.attempt_gps(never_synced);
+      } else if (source == TimeSource::kSntp) {
+        io.attempt_sntp();
+      }
+    }
+    const auto state = io.state();
+    const time_t next_attempt = time_source_next_attempt(
+        state.gps, state.sntp, now, io.sntp_configured);
+    deadline = std::max(next_resync, next_attempt);
+  }
+
+  WakePlan plan;
+  {
+    ScopedPhase phase(WakePhase::kLedUpdate);
+    const int64_t now_us = io.now_us();
+    tm timeinfo;
+    io.local_time(now_us / 1000000, timeinfo);
+
+    // Sleep until the display visibly changes, and ramp there meanwhile
+    const uint32_t display_update_s = leds.seconds_until_update(
+        timeinfo, light, policy->min_wake_interval_s,
+        policy->max_wake_interval_s);
+    plan = plan_wake(now_us, display_update_s, deadline);
+    leds.update(timeinfo, light, plan.fade_ms);
+  }
+
+  {
+    ScopedPhase phase(WakePhase::kStateCommit);
+    io.commit(now);
+  }
+
+  profiler_end_cycle(cycle_start_us);
+
+  ESP_LOGI("SLEEP", "Sleeping for %llu ms",
+           static_cast<unsigned long long>(plan.sleep_us / 1000));
+  io.sleep(plan.sleep_us);
+  return true;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+
+#include <esp_timer.h>
+
+// Phases of one wake cycle of the main loop
+enum class WakePhase : uint8_t {
+  kLightSensor,
+  kBattery,
+  kTimeKeeping,
+  kTimeSync,
+  kLedUpdate,
+  kStateCommit,
+  kCycle, // whole awake time, from wakeup to going back to sleep
+  kCount,
+};
+
+// Print a summary every this many wake cycles. Wakes are 1 to 30 minutes
+// apart depending on the display and the power tier, so this is not a
+// fixed time.
+static constexpr uint32_t kProfilerReportInterval = 60;
+
+// Adds one measurement of `phase`. Stats live in RTC memory, so they keep
+// accumulating across light and deep sleep until the next report.
+void profiler_record(WakePhase phase, int64_t duration_us);
+
+// Logs min/avg/max per phase since the last report and starts a new window
+void profiler_report();
+
+// Marks the end of a wake cycle, reports every kProfilerReportInterval
+void profiler_end_cycle(int64_t cycle_start_us);
+
+// Times the enclosing scope
+class ScopedPhase {
+public:
+  explicit ScopedPhase(WakePhase phase)
+      : m_phase(phase), m_start_us(esp_timer_get_time()) {}
+  ~ScopedPhase() {
+    profiler_record(m_phase, esp_timer_get_time() - m_start_us);
+  }
+
+  ScopedPhase(const ScopedPhase &) = delete;
+  ScopedPhase &operator=(const ScopedPhase &) = delete;
+
+private:
+  WakePhase m_phase;
+  int64_t m_start_us;
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+
+// Wake up this much after the target second, so that an RTC timer that
+// fires slightly early doesn't still see the previous minute
+static constexpr int64_t kWakeGuardUs = 50 * 1000;
+
+struct WakePlan {
+  time_t wake_time;  // UTC second we want to be awake at
+  uint32_t fade_ms;  // from the current whole second to wake_time
+  uint64_t sleep_us; // from now, including the guard
+};
+
+// Plans the next wakeup for `display_update_s` seconds after the current
+// whole second (see LedTime::seconds_until_update), or earlier if
+// `deadline` (e.g. the next GPS resync, 0 for none) comes first.
+inline WakePlan plan_wake(int64_t now_us, uint32_t display_update_s,
+                          time_t deadline) {
+  const time_t now_s = now_us / 1000000;
+  WakePlan plan;
+  plan.wake_time = now_s + display_update_s;
+  if (deadline > now_s && deadline < plan.wake_time) {
+    plan.wake_time = deadline;
+  }
+  plan.fade_ms = static_cast<uint32_t>(plan.wake_time - now_s) * 1000;
+  plan.sleep_us = plan.wake_time * 1000000LL + kWakeGuardUs - now_us;
+  return plan;
+}
@@ -1,55 +1,33 @@
-#include <esp_event.h>
-#include <esp_wifi.h>
-#include <memory>
-
-class WifiTime;
-
-class WiFiEventHandler {
-public:
-  WiFiEventHandler(WifiTime &wifi_time, bool connect_to_preconfigured_station)
-      : m_wifi_time(wifi_time),
-        m_connect_to_preconfigured_station(connect_to_preconfigured_station) {
-    // Store 'this' instance for the static callback
-    instance = this;
-  }
-
-  void handleEvent(esp_event_base_t event_base, int32_t event_id,
-                   void *event_data);
-
-  static void eventHandlerCallback(void *arg, esp_event_base_t event_base,
-                                   int32_t event_id, void *event_data) {
-    // Forward the call to the instance's member function
-    if (instance) {
-      instance->handleEvent(event_base, event_id, event_data);
-    }
-  }
-
-  static WiFiEventHandler *instance;
-  WifiTime &m_wifi_time;
-  int m_retry_num = 0;
-  bool m_connect_to_preconfigured_station = false;
-};
-
-class WifiTime {
-public:
-  WifiTime(bool connect_to_preconfigured_station) {
-    handler = std::make_unique<WiFiEventHandler>(
-        *this, connect_to_preconfigured_station);
-  }
-  // void time_sync_notification_cb(const timeval *tv);
-
-  void wifi_event_handler(void *arg, esp_event_base_t event_base,
-                          int32_t event_id, void *event_data);
-
-  void scanForWifi();
-  void connect(const std::string ssid, const std::string pass);
-  void setup_stack();
-  void configureSNTP();
-  bool isConnected() const {
-    wifi_ap_record_t ap_info;
-    return esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK;
-  }
-
-private:
-  std::unique_ptr<WiFiEventHandler> handler;
-};
\ No newline at end of file
+#pragma once
+
+#include <cstdint>
+
+#include "esp_err.h"
+
+// Network for SNTP syncs, an empty SSID disables the source
+static constexpr const char *kWifiSsid = "";
+static constexpr const char *kWifiPassword = "";
+// Fixed address instead of DHCP, empty to use DHCP. Saves the DHCP
+// exchange even on the first connect.
+static constexpr const char *kWifiStaticIp = "";
+static constexpr const char *kWifiNetmask = "255.255.255.0";
+static constexpr const char *kWifiGateway = "";
+// A host name, or an address to skip DNS, e.g. a local NTP stand-in like
+// tools/ntp_standin.py
+static constexpr const char *kSntpServer = "pool.ntp.org";
+
+// A cached DHCP lease is reused without asking the server for this long
+static constexpr int64_t kWifiLeaseReuseS = 12 * 3600;
+// Connecting to the cached access point with a known address. Past it the
+// sync falls back to a full scan and DHCP, which get the slow timeout.
+static constexpr uint32_t kWifiFastPathTimeoutMs = 2000;
+static constexpr uint32_t kWifiSlowPathTimeoutMs = 10000;
+static constexpr uint32_t kSntpResponseTimeoutMs = 500;
+
+inline bool wifi_time_configured() { return kWifiSsid[0] != '\0'; }
+
+// One-shot sync: connects, asks the server once, sets the clock and turns
+// the radio off again. Access point, channel and address are cached in RTC
+// memory, so later syncs skip the scan and DHCP. The outcome goes into the
+// persistent SNTP stats.
+esp_err_t wifi_time_sync();
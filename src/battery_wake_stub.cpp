@@ -0,0 +1,113 @@
+#include <esp_attr.h>
+#include <esp_log.h>
+#include <esp_sleep.h>
+#include <esp_wake_stub.h>
+#include <soc/sens_reg.h>
+#include <soc/soc.h>
+
+#include "battery_model.hpp"
+#include "battery_wake_stub.hpp"
+#include "light_sensor.hpp"
+
+static const char *TAG = "WAKE_STUB";
+
+// Everything the stub touches has to live in RTC memory, flash and the
+// heap aren't up yet when it runs
+struct WakeStubState {
+  bool armed;
+  uint32_t channel;
+  uint32_t resume_raw;
+  uint32_t sleep_s;
+  uint32_t wakes;
+};
+
+static RTC_DATA_ATTR WakeStubState wake_stub_state;
+
+static constexpr uint32_t kStubSamples = 4;
+// SENS force power up/down values for the SAR and its amplifier
+static constexpr uint32_t kForcePowerDown = 2;
+static constexpr uint32_t kForcePowerUp = 3;
+static constexpr uint32_t kAtten11Db = 3;
+
+// One-shot ADC1 read through the RTC controller, the register level version
+// of what adc1_get_raw() does. The SENS block was reset on wakeup, so set
+// it up from scratch: 12 bit, 11 dB on `channel`, amplifier off.
+// GPIO34..39 are input only without pulls, their pads need no setup.
+static RTC_IRAM_ATTR uint32_t stub_read_adc1(uint32_t channel) {
+  CLEAR_PERI_REG_MASK(SENS_SAR_READ_CTRL_REG, SENS_SAR1_DIG_FORCE);
+  SET_PERI_REG_MASK(SENS_SAR_READ_CTRL_REG, SENS_SAR1_DATA_INV);
+  REG_SET_FIELD(SENS_SAR_READ_CTRL_REG, SENS_SAR1_SAMPLE_BIT, 3);
+  REG_SET_FIELD(SENS_SAR_START_FORCE_REG, SENS_SAR1_BIT_WIDTH, 3);
+  const uint32_t atten_shift = 2 * channel;
+  WRITE_PERI_REG(SENS_SAR_ATTEN1_REG,
+                 (READ_PERI_REG(SENS_SAR_ATTEN1_REG) & ~(3u << atten_shift)) |
+                     (kAtten11Db << atten_shift));
+
+  REG_SET_FIELD(SENS_SAR_MEAS_WAIT2_REG, SENS_FORCE_XPD_AMP, kForcePowerDown);
+  REG_SET_FIELD(SENS_SAR_MEAS_CTRL_REG, SENS_AMP_RST_FB_FSM, 0);
+  REG_SET_FIELD(SENS_SAR_MEAS_CTRL_REG, SENS_AMP_SHORT_REF_FSM, 0);
+  REG_SET_FIELD(SENS_SAR_MEAS_CTRL_REG, SENS_AMP_SHORT_REF_GND_FSM, 0);
+  REG_SET_FIELD(SENS_SAR_MEAS_WAIT1_REG, SENS_SAR_AMP_WAIT1, 1);
+  REG_SET_FIELD(SENS_SAR_MEAS_WAIT1_REG, SENS_SAR_AMP_WAIT2, 1);
+  REG_SET_FIELD(SENS_SAR_MEAS_WAIT2_REG, SENS_SAR_AMP_WAIT3, 1);
+
+  REG_SET_FIELD(SENS_SAR_MEAS_WAIT2_REG, SENS_FORCE_XPD_SAR, kForcePowerUp);
+  SET_PERI_REG_MASK(SENS_SAR_MEAS_START1_REG,
+                    SENS_MEAS1_START_FORCE | SENS_SAR1_EN_PAD_FORCE);
+  REG_SET_FIELD(SENS_SAR_MEAS_START1_REG, SENS_SAR1_EN_PAD, 1u << channel);
+
+  uint32_t sum = 0;
+  for (uint32_t i = 0; i < kStubSamples; i++) {
+    CLEAR_PERI_REG_MASK(SENS_SAR_MEAS_START1_REG, SENS_MEAS1_START_SAR);
+    SET_PERI_REG_MASK(SENS_SAR_MEAS_START1_REG, SENS_MEAS1_START_SAR);
+    while (GET_PERI_REG_MASK(SENS_SAR_MEAS_START1_REG, SENS_MEAS1_DONE_SAR) ==
+           0) {
+    }
+    sum += REG_GET_FIELD(SENS_SAR_MEAS_START1_REG, SENS_MEAS1_DATA_SAR);
+  }
+
+  REG_SET_FIELD(SENS_SAR_MEAS_WAIT2_REG, SENS_FORCE_XPD_SAR, kForcePowerDown);
+  return sum / kStubSamples;
+}
+
+static RTC_IRAM_ATTR void battery_wake_stub() {
+  WakeStubState &state = wake_stub_state;
+  if (state.armed && stub_read_adc1(state.channel) < state.resume_raw) {
+    // Still empty, back off like the application would
+    if (state.sleep_s < kShutdownMaxSleepS) {
+      state.sleep_s *= 2;
+      if (state.sleep_s > kShutdownMaxSleepS) {
+        state.sleep_s = kShutdownMaxSleepS;
+      }
+    }
+    state.wakes++;
+    esp_wake_stub_set_wakeup_time(state.sleep_s * 1000000ULL);
+    esp_wake_stub_sleep(&battery_wake_stub);
+  }
+  // Recovered (or not armed), boot the application
+  esp_default_wake_deep_sleep();
+}
+
+void battery_wake_stub_arm(adc1_channel_t channel, uint32_t resume_adc_mv,
+                           uint32_t sleep_s) {
+  wake_stub_state.channel = channel;
+  wake_stub_state.resume_raw = adc_millivolts_to_raw(resume_adc_mv);
+  wake_stub_state.sleep_s = sleep_s;
+  wake_stub_state.wakes = 0;
+  wake_stub_state.armed = true;
+  esp_set_deep_sleep_wake_stub(&battery_wake_stub);
+  ESP_LOGI(TAG, "Armed, resuming above %lu mV (raw %lu)",
+           static_cast<unsigned long>(resume_adc_mv),
+           static_cast<unsigned long>(wake_stub_state.resume_raw));
+}
+
+uint32_t battery_wake_stub_disarm() {
+  if (!wake_stub_state.armed) {
+    return 0;
+  }
+  wake_stub_state.armed = false;
+  esp_set_deep_sleep_wake_stub(nullptr);
+  ESP_LOGI(TAG, "Handled %lu wakes without booting",
+           static_cast<unsigned long>(wake_stub_state.wakes));
+  return wake_stub_state.wakes;
+}
@@ -0,0 +1,339 @@
+#include <driver/gpio.h>
+#include <esp_attr.h>
+#include <esp_log.h>
+#include <esp_pm.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include <sys/time.h>
+
+#include "gps_acquisition.hpp"
+#include "gps_control.hpp"
+#include "persistent_state.hpp"
+#include "uart_gps.hpp"
+
+static const char *TAG = "GPS";
+
+// Event group bits, set by the reader task and gps_acquisition_stop()
+static constexpr EventBits_t kSyncedBit = BIT0;
+static constexpr EventBits_t kFailedBit = BIT1;
+static constexpr EventBits_t kTaskExitedBit = BIT2;
+static constexpr EventBits_t kTalkingBit = BIT3;
+
+// The reader task looks for the stop notification at least this often. It
+// can't come through the UART event queue, an overflow resets that.
+static constexpr uint32_t kStopPollMs = 100;
+// After RXM-PMREQ the receiver counts as in backup once nothing came in for
+// longer than a measurement period. Twice that is waited for it at most.
+static constexpr int64_t kBackupQuietUs =
+    (kGpsMeasurementRateMs + 500) * 1000LL;
+// Long enough off for the receiver to lose its configuration
+static constexpr uint32_t kPowerCycleMs = 500;
+
+static EventGroupHandle_t gps_events = nullptr;
+static TaskHandle_t gps_task = nullptr;
+static volatile GpsState gps_state = GpsState::kOff;
+// Light sleep gates the UART clock and loses incoming bytes, so automatic
+// light sleep is off while a session runs
+static esp_pm_lock_handle_t gps_pm_lock = nullptr;
+// Powered but asleep, see kGpsUseBackupMode
+static bool gps_in_backup = false;
+// Monotonic time of the latest PPS edge, 0 if none this session
+static int64_t gps_pps_us = 0;
+static portMUX_TYPE gps_pps_mux = portMUX_INITIALIZER_UNLOCKED;
+// Monotonic time the reader task last got bytes
+static int64_t gps_rx_us = 0;
+static portMUX_TYPE gps_rx_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static void set_state(GpsState state) {
+  if (state != gps_state) {
+    ESP_LOGI(TAG, "%s -> %s", gps_state_name(gps_state),
+             gps_state_name(state));
+    gps_state = state;
+  }
+}
+
+static void IRAM_ATTR gps_pps_isr(void *arg) {
+  portENTER_CRITICAL_ISR(&gps_pps_mux);
+  gps_pps_us = esp_timer_get_time();
+  portEXIT_CRITICAL_ISR(&gps_pps_mux);
+}
+
+static int64_t last_pps_us() {
+  portENTER_CRITICAL(&gps_pps_mux);
+  const int64_t pps_us = gps_pps_us;
+  portEXIT_CRITICAL(&gps_pps_mux);
+  return pps_us;
+}
+
+static void set_last_rx_us(int64_t rx_us) {
+  portENTER_CRITICAL(&gps_rx_mux);
+  gps_rx_us = rx_us;
+  portEXIT_CRITICAL(&gps_rx_mux);
+}
+
+static int64_t last_rx_us() {
+  portENTER_CRITICAL(&gps_rx_mux);
+  const int64_t rx_us = gps_rx_us;
+  portEXIT_CRITICAL(&gps_rx_mux);
+  return rx_us;
+}
+
+// Sets up the PPS input, its interrupt stays disabled outside of sessions
+static void setup_pps_input(gpio_num_t pin) {
+  if (pin == GPIO_NUM_NC) {
+    return;
+  }
+  gpio_config_t config = {};
+  config.pin_bit_mask = 1ULL << pin;
+  config.mode = GPIO_MODE_INPUT;
+  config.pull_down_en = GPIO_PULLDOWN_ENABLE;
+  config.intr_type = GPIO_INTR_POSEDGE;
+  gpio_config(&config);
+  gpio_intr_disable(pin);
+  gpio_install_isr_service(0);
+  gpio_isr_handler_add(pin, gps_pps_isr, nullptr);
+}
+
+// Reads the receiver while the session runs. Blocks on the driver's event
+// queue, so it only runs when bytes came in, and returns once notified.
+static void gps_reader_task(void *pvParameters) {
+  // Nothing earlier than the last GPS sync. Not the last SNTP one, a server
+  // that is ahead would keep the receiver's time out.
+  UtcSequenceCheck sequence(persistent_state_get().last_gps_sync_time *
+                            1000000LL);
+  GpsReaderSink sink;
+  sink.sentence = [&sequence](const NmeaSentence &sentence,
+                              const GpsEpochTiming &timing) {
+    return handle_nmea_sentence(sentence, sequence, timing);
+  };
+  sink.frame = [&sequence](const UbxFrame &frame,
+                           const GpsEpochTiming &timing) {
+    return handle_ubx_frame(frame, sequence, timing);
+  };
+  GpsReader reader(UART_NUM_1, gps_uart_queue, kGpsUartPatternQueueLength,
+                   sink);
+
+  uart_event_t event;
+  while (ulTaskNotifyTake(pdTRUE, 0) == 0) {
+    if (xQueueReceive(gps_uart_queue, &event, pdMS_TO_TICKS(kStopPollMs)) !=
+        pdTRUE) {
+      continue;
+    }
+    // As close to the interrupt as we get
+    const int64_t received_us = esp_timer_get_time();
+    if (event.type == UART_DATA || event.type == UART_PATTERN_DET) {
+      set_last_rx_us(received_us);
+    }
+    if (event.type == UART_PATTERN_DET &&
+        gps_state == GpsState::kPowering) {
+      set_state(GpsState::kAcquiring);
+      xEventGroupSetBits(gps_events, kTalkingBit);
+    }
+    if (reader.on_event(event, gps_control_baud_rate(), received_us,
+                        last_pps_us()) &&
+        gps_state != GpsState::kSynced) {
+      set_state(GpsState::kSynced);
+      xEventGroupSetBits(gps_events, kSyncedBit);
+    }
+  }
+
+  if (sequence.rejected() > 0) {
+    ESP_LOGW(TAG, "Rejected %lu out of sequence times",
+             static_cast<unsigned long>(sequence.rejected()));
+  }
+  xEventGroupSetBits(gps_events, kTaskExitedBit);
+  vTaskDelete(NULL);
+}
+
+void gps_acquisition_init() {
+  gps_events = xEventGroupCreate();
+  esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "gps_uart", &gps_pm_lock);
+  gps_control_init();
+  setup_gpio_out();
+  setup_pps_input(GPS_PPS_PIN);
+  power_down_gps();
+}
+
+void gps_acquisition_start() {
+  if (gps_task != nullptr) {
+    return;
+  }
+  xEventGroupClearBits(gps_events,
+                       kSyncedBit | kFailedBit | kTaskExitedBit | kTalkingBit);
+  set_state(GpsState::kPowering);
+  esp_pm_lock_acquire(gps_pm_lock);
+  power_up_gps();
+
+  if (gps_uart_install(gps_control_baud_rate()) != ESP_OK ||
+      xTaskCreate(gps_reader_task, "gps_reader", 4096, NULL, 10, &gps_task) !=
+          pdPASS) {
+    ESP_LOGE(TAG, "Failed to start the reader");
+    gps_in_backup = false;
+    gps_task = nullptr;
+    gps_uart_uninstall();
+    power_down_gps();
+    gps_control_on_power_cut();
+    esp_pm_lock_release(gps_pm_lock);
+    set_state(GpsState::kFailed);
+    xEventGroupSetBits(gps_events, kFailedBit);
+    return;
+  }
+  if (gps_in_backup) {
+    gps_control_wake();
+    gps_in_backup = false;
+  }
+  if (GPS_PPS_PIN != GPIO_NUM_NC) {
+    portENTER_CRITICAL(&gps_pps_mux);
+    gps_pps_us = 0;
+    portEXIT_CRITICAL(&gps_pps_mux);
+    gpio_intr_enable(GPS_PPS_PIN);
+  }
+}
+
+// What is left of `timeout` since `start`
+static TickType_t remaining_ticks(TickType_t start, TickType_t timeout) {
+  const TickType_t waited = xTaskGetTickCount() - start;
+  return timeout == portMAX_DELAY ? portMAX_DELAY
+         : waited < timeout       ? timeout - waited
+                                  : 0;
+}
+
+// Cuts the receiver's supply and powers it up again, at
+// kGpsDefaultBaudRate and with its default output
+static void power_cycle_gps() {
+  xEventGroupClearBits(gps_events, kTalkingBit);
+  set_state(GpsState::kPowering);
+  power_down_gps();
+  gps_control_on_power_cut();
+  vTaskDelay(pdMS_TO_TICKS(kPowerCycleMs));
+  gps_control_set_uart_baud_rate(gps_control_baud_rate());
+  power_up_gps();
+}
+
+GpsState gps_acquisition_wait(TickType_t timeout) {
+  const TickType_t start = xTaskGetTickCount();
+  EventBits_t bits = xEventGroupWaitBits(
+      gps_events, kTalkingBit | kFailedBit, pdFALSE, pdFALSE, timeout);
+  if ((bits & kTalkingBit) != 0) {
+    // The receiver talks, so it listens too. Quiet it down and tell it
+    // what we know before it starts searching in earnest.
+    const esp_err_t err = gps_control_configure();
+    if (err == ESP_ERR_INVALID_STATE && gps_state != GpsState::kSynced) {
+      // Lost at a baud rate we don't know, start over from the default
+      // and make do with its output. Once synced the session is done
+      // anyway, the receiver doesn't go quiet and gets its power cut.
+      ESP_LOGW(TAG, "Receiver lost after a baud rate switch, power cycling");
+      power_cycle_gps();
+      bits = xEventGroupWaitBits(gps_events, kTalkingBit | kFailedBit,
+                                 pdFALSE, pdFALSE,
+                                 remaining_ticks(start, timeout));
+    } else if (err != ESP_OK) {
+      ESP_LOGW(TAG, "Receiver configuration incomplete");
+    }
+  }
+  if ((bits & kTalkingBit) != 0) {
+    gps_control_send_aiding();
+    bits = xEventGroupWaitBits(gps_events, kSyncedBit | kFailedBit, pdFALSE,
+                               pdFALSE, remaining_ticks(start, timeout));
+  }
+  if ((bits & (kSyncedBit | kFailedBit)) == 0) {
+    ESP_LOGW(TAG, "No time from the receiver within %lu ms",
+             static_cast<unsigned long>(timeout * portTICK_PERIOD_MS));
+    set_state(GpsState::kFailed);
+    xEventGroupSetBits(gps_events, kFailedBit);
+  }
+  return gps_state;
+}
+
+// Whether the receiver went quiet after RXM-PMREQ. There is no ACK for
+// it, a receiver that missed it would keep running at full current.
+static bool gps_went_quiet() {
+  const int64_t deadline_us = esp_timer_get_time() + 2 * kBackupQuietUs;
+  for (int64_t now_us = esp_timer_get_time(); now_us < deadline_us;
+       now_us = esp_timer_get_time()) {
+    if (now_us - last_rx_us() > kBackupQuietUs) {
+      return true;
+    }
+    vTaskDelay(pdMS_TO_TICKS(100));
+  }
+  return false;
+}
+
+void gps_acquisition_stop(bool backup) {
+  if (gps_task != nullptr) {
+    gps_in_backup = backup && kGpsUseBackupMode &&
+                    gps_control_enter_backup() == ESP_OK && gps_went_quiet();
+    if (backup && kGpsUseBackupMode && !gps_in_backup) {
+      ESP_LOGW(TAG, "Receiver didn't go to backup, cutting its power");
+    }
+    xTaskNotifyGive(gps_task);
+    xEventGroupWaitBits(gps_events, kTaskExitedBit, pdFALSE, pdFALSE,
+                        portMAX_DELAY);
+    gps_task = nullptr;
+    gps_uart_uninstall();
+    if (GPS_PPS_PIN != GPIO_NUM_NC) {
+      gpio_intr_disable(GPS_PPS_PIN);
+    }
+    esp_pm_lock_release(gps_pm_lock);
+  }
+  if (!gps_in_backup) {
+    power_down_gps();
+    gps_control_on_power_cut();
+  }
+  set_state(GpsState::kOff);
+}
+
+GpsState gps_acquisition_attempt(bool cold) {
+  const int64_t start_us = esp_timer_get_time();
+  gps_acquisition_start();
+  const GpsState result =
+      gps_acquisition_wait(pdMS_TO_TICKS(gps_attempt_budget_ms(cold)));
+  gps_acquisition_stop();
+  const uint32_t on_s = (esp_timer_get_time() - start_us) / 1000000;
+
+  // After the sync, so the clock is the new one
+  time_t now = 0;
+  time(&now);
+  auto state = persistent_state_get();
+  GpsAttemptStats &stats = state.gps;
+  if (result == GpsState::kSynced) {
+    gps_attempt_on_success(stats, on_s);
+  } else {
+    gps_attempt_on_failure(stats, on_s, now);
+    ESP_LOGW(TAG, "Attempt failed (%u in a row), next one in %lld s",
+             stats.consecutive_failures, stats.next_attempt_time - now);
+  }
+  ESP_LOGI(TAG,
+           "%lu attempts, %lu failed, time to fix %u s (avg %lu, max %u), "
+           "%lu s on",
+           static_cast<unsigned long>(stats.attempts),
+           static_cast<unsigned long>(stats.failures), stats.last_ttf_s,
+           static_cast<unsigned long>(
+               stats.attempts > stats.failures
+                   ? stats.ttf_sum_s / (stats.attempts - stats.failures)
+                   : 0),
+           stats.max_ttf_s, static_cast<unsigned long>(stats.on_time_s));
+  persistent_state_set(state, false);
+  return result;
+}
+
+GpsState gps_acquisition_state() { return gps_state; }
+
+const char *gps_state_name(GpsState state) {
+  switch (state) {
+  case GpsState::kOff:
+    return "off";
+  case GpsState::kPowering:
+    return "powering";
+  case GpsState::kAcquiring:
+    return "acquiring";
+  case GpsState::kSynced:
+    return "synced";
+  case GpsState::kFailed:
+    return "failed";
+  }
+  return "?";
+}
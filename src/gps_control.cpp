@@ -0,0 +1,211 @@
+#include <driver/uart.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include <sys/time.h>
+
+#include "gps_control.hpp"
+#include "gps_timing.hpp"
+#include "persistent_state.hpp"
+
+static const char *TAG = "GPS_CTRL";
+
+struct UbxAck {
+  uint8_t cls; // class and id of the acknowledged message
+  uint8_t id;
+  bool ack; // false for a NAK
+};
+
+static constexpr int kAckQueueLength = 4;
+// Bytes sent to pull the receiver out of backup, they are lost themselves
+static constexpr int kWakeBytes = 8;
+
+// Sentences and their rate per navigation solution. RMC brings the fix.
+// GGA and GLL are parsed too, but only repeat what RMC says, and ZDA can't
+// tell a valid time from the receiver's default.
+struct NmeaOutput {
+  uint8_t id;
+  uint8_t rate;
+};
+static constexpr NmeaOutput kNmeaOutputs[] = {
+    {kUbxIdNmeaGga, 0}, {kUbxIdNmeaGll, 0}, {kUbxIdNmeaGsa, 0},
+    {kUbxIdNmeaGsv, 0}, {kUbxIdNmeaRmc, 1}, {kUbxIdNmeaVtg, 0},
+    {kUbxIdNmeaZda, 0},
+};
+
+static QueueHandle_t ack_queue = nullptr;
+static uint32_t gps_baud_rate = kGpsDefaultBaudRate;
+
+void gps_control_init() {
+  ack_queue = xQueueCreate(kAckQueueLength, sizeof(UbxAck));
+}
+
+esp_err_t gps_control_send(uint8_t cls, uint8_t id, const uint8_t *payload,
+                           uint16_t length, bool wait_ack) {
+  if (length > kUbxMaxPayload) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  uint8_t frame[kUbxMaxPayload + kUbxFrameOverhead];
+  const size_t size = ubx_frame(cls, id, payload, length, frame);
+
+  // ACKs of earlier commands that nobody waited for
+  xQueueReset(ack_queue);
+  if (uart_write_bytes(UART_NUM_1, frame, size) != static_cast<int>(size)) {
+    return ESP_FAIL;
+  }
+  if (!wait_ack) {
+    return ESP_OK;
+  }
+
+  const TickType_t start = xTaskGetTickCount();
+  const TickType_t timeout = pdMS_TO_TICKS(kUbxAckTimeoutMs);
+  UbxAck ack;
+  for (TickType_t waited = 0; waited < timeout;
+       waited = xTaskGetTickCount() - start) {
+    if (xQueueReceive(ack_queue, &ack, timeout - waited) != pdTRUE) {
+      break;
+    }
+    if (ack.cls == cls && ack.id == id) {
+      if (!ack.ack) {
+        ESP_LOGW(TAG, "0x%02x 0x%02x rejected", cls, id);
+      }
+      return ack.ack ? ESP_OK : ESP_FAIL;
+    }
+  }
+  ESP_LOGW(TAG, "0x%02x 0x%02x not acknowledged", cls, id);
+  return ESP_ERR_TIMEOUT;
+}
+
+void gps_control_on_frame(const UbxFrame &frame) {
+  if (frame.cls == kUbxClassAck && frame.length == 2) {
+    const UbxAck ack = {.cls = frame.payload[0],
+                        .id = frame.payload[1],
+                        .ack = frame.id == kUbxIdAckAck};
+    xQueueSend(ack_queue, &ack, 0);
+  }
+}
+
+static esp_err_t send_measurement_rate() {
+  uint8_t payload[kUbxCfgRateLength];
+  ubx_cfg_rate(kGpsMeasurementRateMs, payload);
+  return gps_control_send(kUbxClassCfg, kUbxIdCfgRate, payload,
+                          sizeof(payload), true);
+}
+
+static esp_err_t switch_baud_rate(uint32_t baud_rate) {
+  uint8_t payload[kUbxCfgPrtLength];
+  ubx_cfg_prt_uart(baud_rate, payload);
+  // The receiver may answer at either rate, don't rely on that ACK
+  gps_control_send(kUbxClassCfg, kUbxIdCfgPrt, payload, sizeof(payload),
+                   false);
+  uart_wait_tx_done(UART_NUM_1, pdMS_TO_TICKS(100));
+  vTaskDelay(pdMS_TO_TICKS(100));
+
+  // See whether the receiver followed. It may have, even if the answer
+  // at the new rate got lost, so ask at the old one too.
+  const uint32_t rates[] = {baud_rate, gps_baud_rate};
+  for (const uint32_t rate : rates) {
+    gps_control_set_uart_baud_rate(rate);
+    if (send_measurement_rate() == ESP_OK) {
+      ESP_LOGI(TAG, "Receiver at %lu baud",
+               static_cast<unsigned long>(rate));
+      gps_baud_rate = rate;
+      return rate == baud_rate ? ESP_OK : ESP_ERR_TIMEOUT;
+    }
+  }
+  ESP_LOGW(TAG, "No answer at %lu or %lu baud",
+           static_cast<unsigned long>(baud_rate),
+           static_cast<unsigned long>(gps_baud_rate));
+  return ESP_ERR_INVALID_STATE;
+}
+
+static esp_err_t send_output_rate(uint8_t cls, uint8_t id, uint8_t rate) {
+  uint8_t payload[kUbxCfgMsgLength];
+  ubx_cfg_msg(cls, id, rate, payload);
+  return gps_control_send(kUbxClassCfg, kUbxIdCfgMsg, payload,
+                          sizeof(payload), true);
+}
+
+esp_err_t gps_control_configure() {
+  for (const auto &output : kNmeaOutputs) {
+    const esp_err_t err =
+        send_output_rate(kUbxClassNmea, output.id, output.rate);
+    if (err != ESP_OK) {
+      return err;
+    }
+  }
+  // Valid UTC before the fix, but only once there is a position for the
+  // timezone
+  const bool time_only =
+      kGpsTimeOnly && persistent_state_get().position.time != 0;
+  esp_err_t err =
+      send_output_rate(kUbxClassNav, kUbxIdNavTimeutc, time_only ? 1 : 0);
+  if (err == ESP_OK) {
+    err = send_measurement_rate();
+  }
+  if (err == ESP_OK && kGpsFastBaudRate != 0 &&
+      gps_baud_rate != kGpsFastBaudRate) {
+    err = switch_baud_rate(kGpsFastBaudRate);
+  }
+  return err;
+}
+
+uint32_t gps_control_baud_rate() { return gps_baud_rate; }
+
+void gps_control_set_uart_baud_rate(uint32_t baud_rate) {
+  uart_set_baudrate(UART_NUM_1, baud_rate);
+  // Pattern detection timing is in bit periods, set it up again
+  uart_enable_pattern_det_baud_intr(UART_NUM_1, '\n', 1, kGpsPatternGapBits,
+                                    kGpsPatternPostIdleBits, 0);
+}
+
+void gps_control_on_power_cut() { gps_baud_rate = kGpsDefaultBaudRate; }
+
+void gps_control_wake() {
+  const uint8_t wake[kWakeBytes] = {0xff, 0xff, 0xff, 0xff,
+                                    0xff, 0xff, 0xff, 0xff};
+  uart_write_bytes(UART_NUM_1, wake, sizeof(wake));
+}
+
+esp_err_t gps_control_enter_backup() {
+  uint8_t payload[kUbxRxmPmreqLength];
+  ubx_rxm_pmreq_backup(payload);
+  // The receiver goes down right away, there is no ACK
+  const esp_err_t err = gps_control_send(kUbxClassRxm, kUbxIdRxmPmreq, payload,
+                                         sizeof(payload), false);
+  if (err != ESP_OK) {
+    return err;
+  }
+  return uart_wait_tx_done(UART_NUM_1, pdMS_TO_TICKS(100));
+}
+
+esp_err_t gps_control_send_aiding() {
+  const auto state = persistent_state_get();
+  GpsAiding aiding = {};
+
+  aiding.position_valid = state.position.time != 0;
+  aiding.latitude_e7 = state.position.latitude_e7;
+  aiding.longitude_e7 = state.position.longitude_e7;
+  aiding.position_accuracy_cm = kGpsAidPositionAccuracyCm;
+
+  timeval now;
+  gettimeofday(&now, NULL);
+  aiding.utc_us = now.tv_sec * 1000000LL + now.tv_usec;
+  aiding.time_valid = state.drift.anchor_time_us != 0;
+  if (aiding.time_valid) {
+    aiding.time_accuracy_ms =
+        drift_model_expected_error_us(state.drift, aiding.utc_us) / 1000;
+  }
+
+  if (!aiding.position_valid && !aiding.time_valid) {
+    return ESP_OK;
+  }
+  uint8_t payload[kUbxAidIniLength];
+  ubx_aid_ini(aiding, payload);
+  ESP_LOGI(TAG, "Aiding: position %s, time +/- %lu ms",
+           aiding.position_valid ? "yes" : "no",
+           static_cast<unsigned long>(aiding.time_accuracy_ms));
+  return gps_control_send(kUbxClassAid, kUbxIdAidIni, payload,
+                          sizeof(payload), false);
+}
@@ -0,0 +1,130 @@
+#include <algorithm>
+
+#include <esp_adc_cal.h>
+#include <esp_attr.h>
+#include <esp_log.h>
+#include <esp_pm.h>
+#include <esp_rom_sys.h>
+
+#include "light_sensor.hpp"
+
+static constexpr int kBurstSamples = 8;
+// Samples dropped from each end of the sorted burst
+static constexpr int kBurstTrim = 2;
+static constexpr uint32_t kDefaultVrefMv = 1100;
+
+struct AdcFilter {
+  uint32_t history[3]; // last raw readings in mV, for the median
+  uint32_t value_q4;   // filtered mV, 4 fractional bits
+  uint8_t count;
+};
+
+static RTC_DATA_ATTR AdcFilter adc_filters[ADC1_CHANNEL_MAX];
+static AdcSampling adc_sampling[ADC1_CHANNEL_MAX];
+static esp_adc_cal_characteristics_t adc_characteristics;
+static bool adc_characterized = false;
+static esp_pm_lock_handle_t adc_pm_lock = nullptr;
+
+void init_adc(const adc1_channel_t adc_channel, const AdcSampling &sampling) {
+  adc1_config_width(ADC_WIDTH_BIT_12); // Configure the ADC resolution
+  adc1_config_channel_atten(adc_channel, ADC_ATTEN_DB_11);
+  adc_sampling[adc_channel] = sampling;
+
+  if (adc_pm_lock == nullptr) {
+    esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "adc", &adc_pm_lock);
+  }
+
+  if (!adc_characterized) {
+    const auto source =
+        esp_adc_cal_characterize(ADC_UNIT_1, ADC_ATTEN_DB_11, ADC_WIDTH_BIT_12,
+                                 kDefaultVrefMv, &adc_characteristics);
+    ESP_LOGI("ADC", "Calibration from %s",
+             source == ESP_ADC_CAL_VAL_EFUSE_TP     ? "eFuse two point"
+             : source == ESP_ADC_CAL_VAL_EFUSE_VREF ? "eFuse Vref"
+                                                    : "default Vref");
+    adc_characterized = true;
+  }
+}
+
+// Trimmed mean of a burst, in calibrated mV
+static uint32_t sample_burst(const adc1_channel_t adc_channel) {
+  const uint32_t spacing_us =
+      adc_sampling[adc_channel].burst_span_us / kBurstSamples;
+
+  // The burst is timed by busy-waiting, keep DFS from switching the clock
+  // underneath it so the samples stay evenly spread
+  esp_pm_lock_acquire(adc_pm_lock);
+  int samples[kBurstSamples];
+  for (int i = 0; i < kBurstSamples; i++) {
+    samples[i] = adc1_get_raw(adc_channel);
+    if (spacing_us > 0 && i + 1 < kBurstSamples) {
+      esp_rom_delay_us(spacing_us);
+    }
+  }
+  esp_pm_lock_release(adc_pm_lock);
+  std::sort(samples, samples + kBurstSamples);
+
+  uint32_t sum = 0;
+  for (int i = kBurstTrim; i < kBurstSamples - kBurstTrim; i++) {
+    sum += samples[i];
+  }
+  const uint32_t raw = sum / (kBurstSamples - 2 * kBurstTrim);
+  return esp_adc_cal_raw_to_voltage(raw, &adc_characteristics);
+}
+
+static uint32_t history_median(const AdcFilter &filter) {
+  return std::max(std::min(filter.history[0], filter.history[1]),
+                  std::min(std::max(filter.history[0], filter.history[1]),
+                           filter.history[2]));
+}
+
+uint32_t read_adc_millivolts(const adc1_channel_t adc_channel) {
+  AdcFilter &filter = adc_filters[adc_channel];
+
+  if (filter.count == 0) {
+    // No history yet to take the median of. A single burst would go
+    // through unfiltered, and the first battery reading after a resume
+    // decides about deep sleep: fill it with bursts back to back.
+    for (uint32_t &mv : filter.history) {
+      mv = sample_burst(adc_channel);
+    }
+    const uint32_t median = history_median(filter);
+    filter.value_q4 = median << 4;
+    filter.count = 1;
+    return median;
+  }
+
+  filter.history[2] = filter.history[1];
+  filter.history[1] = filter.history[0];
+  filter.history[0] = sample_burst(adc_channel);
+  const uint32_t median = history_median(filter);
+
+  const int32_t error =
+      static_cast<int32_t>(median << 4) - static_cast<int32_t>(filter.value_q4);
+  filter.value_q4 += error >> adc_sampling[adc_channel].iir_shift;
+  return filter.value_q4 >> 4;
+}
+
+float read_adc_value(const adc1_channel_t adc_channel) {
+  return static_cast<float>(read_adc_millivolts(adc_channel)) /
+         kAdcFullScaleMv;
+}
+
+void reset_adc_filter(const adc1_channel_t adc_channel) {
+  adc_filters[adc_channel].count = 0;
+}
+
+uint32_t adc_millivolts_to_raw(uint32_t mv) {
+  // The calibration is monotonic, bisect it
+  uint32_t lo = 0;
+  uint32_t hi = 4095;
+  while (lo < hi) {
+    const uint32_t mid = (lo + hi) / 2;
+    if (esp_adc_cal_raw_to_voltage(mid, &adc_characteristics) < mv) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
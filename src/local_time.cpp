@@ -0,0 +1,52 @@
+#include <cstdlib>
+#include <esp_attr.h>
+#include <esp_log.h>
+
+#include "local_time.hpp"
+#include "posix_tz.hpp"
+
+static const char *TAG = "LOCAL_TIME";
+
+// The span of the current offset, and the zone it was worked out for
+struct LocalTimeCache {
+  uint32_t zone_hash;
+  PosixTzSpan span;
+};
+
+// Zeroed on power-on, an empty span never matches
+static RTC_DATA_ATTR LocalTimeCache cache;
+static PosixTz zone = {};
+static uint32_t zone_hash = 0;
+
+// FNV-1a, tells zones apart across deep sleep
+static uint32_t hash_zone(const char *s) {
+  uint32_t hash = 2166136261u;
+  for (; *s != '\0'; s++) {
+    hash = (hash ^ static_cast<uint8_t>(*s)) * 16777619u;
+  }
+  return hash;
+}
+
+void local_time_set_zone(const char *posix_tz) {
+  if (!posix_tz_parse(posix_tz, zone)) {
+    ESP_LOGW(TAG, "Can't parse TZ '%s', using UTC", posix_tz);
+    zone = {};
+  }
+  zone_hash = hash_zone(posix_tz);
+  setenv("TZ", posix_tz, 1);
+  tzset();
+}
+
+void local_time_from_utc(time_t utc, tm &local) {
+  if (cache.zone_hash != zone_hash || utc < cache.span.from ||
+      utc >= cache.span.until) {
+    cache.span = posix_tz_span(zone, utc);
+    cache.zone_hash = zone_hash;
+    ESP_LOGI(TAG, "UTC%+ld s%s until %lld",
+             static_cast<long>(cache.span.offset_s),
+             cache.span.dst ? " (DST)" : "",
+             static_cast<long long>(cache.span.until));
+  }
+  civil_breakdown(utc + cache.span.offset_s, local);
+  local.tm_isdst = cache.span.dst;
+}
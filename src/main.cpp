@@ -1,55 +1,132 @@
 #include <driver/gpio.h>
 #include <driver/ledc.h>
+#include <esp_attr.h>
 #include <esp_event.h>
 #include <esp_log.h>
+#include <esp_pm.h>
 #include <esp_sleep.h>
+#include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <nvs.h>
 #include <nvs_flash.h>
 #include <time.h>
 
-#include "helpers.hpp"
+#include "battery_model.hpp"
+#include "battery_wake_stub.hpp"
+#include "gps_acquisition.hpp"
 #include "led_time.hpp"
 #include "light_sensor.hpp"
-#include "uart_gps.hpp"
+#include "local_time.hpp"
+#include "nightstand_layout.hpp"
+#include "persistent_state.hpp"
+#include "time_source.hpp"
+#include "timezone.hpp"
+#include "wake_cycle.hpp"
+#include "wifi_time.hpp"
 
-#include <unordered_map>
+#include <algorithm>
 
 #define DEMO_MODE 0
 #define BATTERY_POWERED 1
 
-void check_battery_voltage_and_sleep(LedTime *led_time = nullptr) {
-  static constexpr float kAdcRefVoltage = 3.3;
-  static constexpr float kVoltageDividerFactor = 2.0;
-  const auto adc_value_battery = read_adc_value(ADC1_CHANNEL_7);
-  const auto battery_voltage =
-      adc_value_battery * kAdcRefVoltage * kVoltageDividerFactor;
-  ESP_LOGI("BATTERY", "adc_value_battery: %f\n", adc_value_battery);
-  ESP_LOGI("BATTERY", "Voltage: %f\n", battery_voltage);
-
-  static constexpr auto kSleepBv = 3.0;
-  if (battery_voltage < kSleepBv) {
-    power_down_gps();
+static RTC_DATA_ATTR BatteryEstimate battery_estimate;
+
+// The battery is measured through a 1:1 divider
+static constexpr uint32_t kVoltageDividerFactor = 2;
+// Headroom above the shutdown exit voltage before the wake stub boots, so
+// the loaded reading after boot still clears the exit threshold despite ADC
+// noise and the cell sagging under the boot current
+static constexpr uint32_t kWakeStubResumeMarginMv = 20;
+
+// Updates the charge estimate and returns the power policy for it. On an
+// empty cell this doesn't return but enters deep sleep, and wakes up less
+// and less often while the cell stays empty.
+const PowerPolicy &
+check_battery_voltage_and_sleep(ClockLeds *led_time = nullptr) {
+  const auto adc_mv_battery = read_adc_millivolts(ADC1_CHANNEL_7);
+  const uint32_t battery_mv = adc_mv_battery * kVoltageDividerFactor;
+
+  time_t now = 0;
+  time(&now);
+  const PowerTier previous_tier = battery_estimate.tier;
+  battery_update(battery_estimate, battery_mv, now);
+  const PowerPolicy &policy = power_policy(battery_estimate.tier);
+  ESP_LOGI("BATTERY", "%lu mV, SoC %ld permille, trend %ld permille/day",
+           static_cast<unsigned long>(battery_mv),
+           static_cast<long>(battery_estimate.soc_permille),
+           static_cast<long>(battery_estimate.trend_permille_per_day));
+  if (battery_estimate.tier != previous_tier) {
+    ESP_LOGW("BATTERY", "Power tier %s -> %s",
+             power_policy(previous_tier).name, policy.name);
+  }
+
+  if (battery_estimate.tier == PowerTier::kShutdown) {
+    // RTC memory survives deep sleep, but not the cell running flat
+    persistent_state_commit(now, true);
+
+    // Deep sleep drops the power pin anyway, no point in a backup
+    gps_acquisition_stop(false);
     if (led_time != nullptr) {
       led_time->turn_off();
     }
-    esp_sleep_enable_timer_wakeup(100000000); // 100 seconds in microseconds
+    const uint32_t sleep_s = shutdown_sleep_s(battery_estimate.shutdown_wakes);
+    if (battery_estimate.shutdown_wakes < UINT8_MAX) {
+      battery_estimate.shutdown_wakes++;
+    }
+    ESP_LOGW("BATTERY", "Cell empty, deep sleep for %lu s",
+             static_cast<unsigned long>(sleep_s));
+
+    // Let the wake stub check the cell without booting, and only come back
+    // here once it is clearly above the shutdown tier's exit threshold. The
+    // stub reads an almost unloaded cell, battery_update() a loaded one that
+    // has to come out strictly above the exit charge.
+    const uint32_t resume_mv = soc_permille_to_ocv(policy.exit_above_permille) +
+                               kLoadCorrectionMv + kWakeStubResumeMarginMv;
+    battery_wake_stub_arm(ADC1_CHANNEL_7, resume_mv / kVoltageDividerFactor,
+                          sleep_s);
+    // Hours may pass until the next reading
+    reset_adc_filter(ADC1_CHANNEL_7);
+    esp_sleep_enable_timer_wakeup(sleep_s * 1000000ULL);
     // Enter deep sleep mode
     esp_deep_sleep_start();
   }
+  return policy;
+}
+
+// Picks the TZ for the last known position, if there is one
+void apply_timezone() {
+  const auto position = persistent_state_get().position;
+  if (position.time != 0) {
+    timezone_apply_position(position.latitude_e7, position.longitude_e7);
+  }
+}
+
+// Lets the idle task enter light sleep whenever all tasks are blocked, and
+// runs the CPU only as fast as the PM locks currently held demand
+void configure_power_management() {
+  esp_pm_config_t pm_config = {
+      .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+      .min_freq_mhz = 40, // XTAL
+      .light_sleep_enable = true,
+  };
+  ESP_ERROR_CHECK_WITHOUT_ABORT(esp_pm_configure(&pm_config));
 }
 
 extern "C" void app_main() {
   ESP_LOGI("MAIN", "starting");
+  configure_power_management();
   vTaskDelay(2000 / portTICK_PERIOD_MS);
 
-  setenv("TZ", "UTC", 1);
-  tzset();
+  local_time_set_zone("UTC");
 
-  init_adc(ADC1_CHANNEL_6);
-  init_adc(ADC1_CHANNEL_7);
-  uart_init();
+  init_adc(ADC1_CHANNEL_6, kLightSensorSampling);
+  init_adc(ADC1_CHANNEL_7, kBatterySampling);
+  // Wakes the stub handled while the cell was empty still count for the
+  // shutdown backoff
+  battery_estimate.shutdown_wakes = std::min<uint32_t>(
+      battery_estimate.shutdown_wakes + battery_wake_stub_disarm(), UINT8_MAX);
+  gps_acquisition_init();
 
   // Initialize NVS - we store latest gps sync
   esp_err_t ret = nvs_flash_init();
@@ -59,63 +136,67 @@ extern "C" void app_main() {
     ret = nvs_flash_init();
   }
   ESP_ERROR_CHECK(ret);
+  persistent_state_init();
+  apply_timezone();
 
   if (BATTERY_POWERED) {
     check_battery_voltage_and_sleep();
   }
 
-  power_up_gps();
-  xTaskCreate(uart_task, "uart_task", 4096, NULL, 10, NULL);
-
-  std::unordered_map<int, std::pair<gpio_num_t, ledc_channel_t>>
-      led_gpio_channels{
-          {0, std::make_pair(GPIO_NUM_13, LEDC_CHANNEL_0)},
-          {1, std::make_pair(GPIO_NUM_12, LEDC_CHANNEL_1)},
-          {2, std::make_pair(GPIO_NUM_14, LEDC_CHANNEL_2)},
-          {3, std::make_pair(GPIO_NUM_27, LEDC_CHANNEL_3)},
-          {4, std::make_pair(GPIO_NUM_26, LEDC_CHANNEL_4)},
-          {5, std::make_pair(GPIO_NUM_25, LEDC_CHANNEL_5)},
-      };
-  LedTime led_time{led_gpio_channels};
+  ClockLeds led_time;
   if (DEMO_MODE) {
     led_time.demo_mode();
   }
 
-  tm timeinfo;
-  while (true) {
-    const auto adc_value_light_sensor = read_adc_value(ADC1_CHANNEL_6);
-    ESP_LOGI("LIGHT", "ADC Value: %f\n", adc_value_light_sensor);
-
-    if (BATTERY_POWERED) {
-      check_battery_voltage_and_sleep(&led_time);
-    }
-
-    time_t last_gps_time;
-    ESP_ERROR_CHECK(read_event_time_from_nvs("gps_time", &last_gps_time));
-    time_t now = 0;
-    time(&now);
-    ESP_LOGI("TIMESYNC", "now(%lld) - last_gps_time(%lld): %lld", now,
-             last_gps_time, now - last_gps_time);
-
-    const auto time_outdated = (now - last_gps_time) > 60 * 60 * 24 * 30;
-
-    if (time_outdated) {
-      // uninitialize system time
-      struct timeval reset_time = {.tv_sec = 0};
-      settimeofday(&reset_time, NULL);
-    }
-
-    while (!time_is_synchronized(timeinfo)) {
-      power_up_gps();
-      ESP_LOGI("TIMESYNC", "Waiting for timesync");
-      vTaskDelay(2000 / portTICK_PERIOD_MS);
-    }
-    power_down_gps();
-
-    led_time.update(timeinfo, adc_value_light_sensor);
-
-    esp_sleep_enable_timer_wakeup(60 * 1000000);
-    ESP_LOGI("SLEEP", "Entering light sleep for 60 seconds");
-    esp_light_sleep_start();
+  const WakeIo io = {
+      .read_light = [] { return read_adc_value(ADC1_CHANNEL_6); },
+      .check_battery =
+          [&led_time] {
+            return BATTERY_POWERED
+                       ? &check_battery_voltage_and_sleep(&led_time)
+                       : &power_policy(PowerTier::kNormal);
+          },
+      .now_us =
+          [] {
+            timeval tv;
+            gettimeofday(&tv, NULL);
+            return tv.tv_sec * 1000000LL + tv.tv_usec;
+          },
+      .set_time_us =
+          [](int64_t utc_us) {
+            const timeval tv = {.tv_sec = utc_us / 1000000,
+                                .tv_usec = static_cast<suseconds_t>(
+                                    utc_us % 1000000)};
+            settimeofday(&tv, NULL);
+          },
+      .local_time = [](time_t utc, tm &local) {
+        local_time_from_utc(utc, local);
+      },
+      .attempt_gps =
+          [](bool first) {
+            if (gps_acquisition_attempt(first) == GpsState::kSynced) {
+              apply_timezone();
+            }
+          },
+      .attempt_sntp = [] { wifi_time_sync(); },
+      .sntp_configured = wifi_time_configured(),
+      .state = [] { return persistent_state_get(); },
+      .set_state =
+          [](const PersistentState &state) {
+            persistent_state_set(state, false);
+          },
+      .commit = [](time_t now) { persistent_state_commit(now); },
+      .sleep =
+          [](uint64_t sleep_us) {
+            // Blocking is enough, tickless idle turns the wait into light
+            // sleep. Round up, waking early would still see the previous
+            // minute.
+            static constexpr uint64_t kTickUs = 1000000 / configTICK_RATE_HZ;
+            vTaskDelay((sleep_us + kTickUs - 1) / kTickUs);
+          },
+  };
+  // An empty cell sends the clock to deep sleep from check_battery, so
+  // this never ends
+  while (wake_cycle(io, led_time)) {
   }
 }
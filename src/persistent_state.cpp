@@ -0,0 +1,186 @@
+#include <cstddef>
+
+#include <esp_attr.h>
+#include <esp_log.h>
+#include <esp_pm.h>
+#include <esp_rom_crc.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <nvs.h>
+
+#include "persistent_state.hpp"
+
+static const char *TAG = "STATE";
+
+static constexpr uint32_t kRtcMagic = 0x4c554d31; // "LUM1"
+static constexpr const char *kNvsNamespace = "storage";
+static constexpr const char *kNvsStateKey = "state";
+// Key used before the state block existed, still read on cold boot
+static constexpr const char *kNvsLegacyTimeKey = "gps_time";
+
+// Syncs further apart than this belong to different GPS sessions
+static constexpr int64_t kPersistentSessionGap = 60 * 60;
+// Upper bound for how long coalesced changes stay RTC-only
+static constexpr int64_t kNvsWriteInterval = 60 * 60 * 24;
+
+struct RtcBlock {
+  uint32_t magic;
+  PersistentState state;
+  int64_t last_nvs_write_time;
+  bool dirty;
+  uint32_t crc;
+};
+
+static RTC_DATA_ATTR RtcBlock rtc_block;
+static SemaphoreHandle_t state_mutex = nullptr;
+static esp_pm_lock_handle_t nvs_pm_lock = nullptr;
+
+static uint32_t block_crc(const RtcBlock &block) {
+  return esp_rom_crc32_le(0, reinterpret_cast<const uint8_t *>(&block),
+                          offsetof(RtcBlock, crc));
+}
+
+static void seal_block() { rtc_block.crc = block_crc(rtc_block); }
+
+static esp_err_t write_nvs(time_t now) {
+  nvs_handle_t handle;
+  esp_err_t err = nvs_open(kNvsNamespace, NVS_READWRITE, &handle);
+  if (err != ESP_OK)
+    return err;
+
+  // Flash operations run with the cache disabled and the CPU spinning, get
+  // them over with at full speed
+  esp_pm_lock_acquire(nvs_pm_lock);
+  rtc_block.state.nvs_write_count++;
+  err = nvs_set_blob(handle, kNvsStateKey, &rtc_block.state,
+                     sizeof(rtc_block.state));
+  if (err == ESP_OK)
+    err = nvs_commit(handle);
+  nvs_close(handle);
+  esp_pm_lock_release(nvs_pm_lock);
+
+  if (err != ESP_OK) {
+    rtc_block.state.nvs_write_count--;
+    return err;
+  }
+  rtc_block.last_nvs_write_time = now;
+  rtc_block.dirty = false;
+  ESP_LOGI(TAG, "State written to NVS (%lu writes)",
+           static_cast<unsigned long>(rtc_block.state.nvs_write_count));
+  return ESP_OK;
+}
+
+static void read_nvs(PersistentState &state) {
+  state = {};
+  nvs_handle_t handle;
+  if (nvs_open(kNvsNamespace, NVS_READONLY, &handle) != ESP_OK)
+    return;
+
+  // A blob written by an older firmware is shorter, but still a valid
+  // prefix since fields are only ever appended. The rest stays zero.
+  size_t size = sizeof(state);
+  if (nvs_get_blob(handle, kNvsStateKey, &state, &size) != ESP_OK ||
+      size < offsetof(PersistentState, gps)) {
+    state = {};
+    int64_t legacy_time = 0;
+    if (nvs_get_i64(handle, kNvsLegacyTimeKey, &legacy_time) == ESP_OK) {
+      state.last_sync_time = legacy_time;
+      state.session_start_time = legacy_time;
+    }
+  }
+  nvs_close(handle);
+}
+
+void persistent_state_init() {
+  if (state_mutex == nullptr) {
+    state_mutex = xSemaphoreCreateMutex();
+    esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "nvs", &nvs_pm_lock);
+  }
+
+  if (rtc_block.magic == kRtcMagic && rtc_block.crc == block_crc(rtc_block)) {
+    ESP_LOGI(TAG, "Restored state from RTC memory");
+    return;
+  }
+
+  ESP_LOGI(TAG, "RTC state invalid, recovering from NVS");
+  rtc_block = {};
+  rtc_block.magic = kRtcMagic;
+  read_nvs(rtc_block.state);
+  seal_block();
+}
+
+PersistentState persistent_state_get() {
+  xSemaphoreTake(state_mutex, portMAX_DELAY);
+  const PersistentState state = rtc_block.state;
+  xSemaphoreGive(state_mutex);
+  return state;
+}
+
+void persistent_state_set(const PersistentState &state, bool significant) {
+  xSemaphoreTake(state_mutex, portMAX_DELAY);
+  rtc_block.state = state;
+  rtc_block.dirty = true;
+  if (significant) {
+    time_t now = 0;
+    time(&now);
+    ESP_ERROR_CHECK_WITHOUT_ABORT(write_nvs(now));
+  }
+  seal_block();
+  xSemaphoreGive(state_mutex);
+}
+
+void persistent_state_record_sync(int64_t gps_us, int64_t local_us,
+                                  SyncQuality quality) {
+  const time_t sync_time = gps_us / 1000000;
+  xSemaphoreTake(state_mutex, portMAX_DELAY);
+  PersistentState &state = rtc_block.state;
+  const bool new_session = state.last_sync_time == 0 ||
+                           sync_time - state.last_sync_time >
+                               kPersistentSessionGap;
+  const bool better_quality = quality > state.sync_quality;
+
+  if (new_session) {
+    state.session_start_time = sync_time;
+    state.session_count++;
+  }
+  // Time without a fix may be the receiver's free-running guess
+  if (quality >= SyncQuality::kFix) {
+    drift_model_on_sync(state.drift, local_us, gps_us);
+  }
+  state.last_sync_time = sync_time;
+  if (quality == SyncQuality::kFix || quality == SyncQuality::kUtcValid) {
+    state.last_gps_sync_time = sync_time;
+  }
+  state.sync_quality = quality;
+  state.sync_count++;
+  rtc_block.dirty = true;
+
+  if (new_session || better_quality) {
+    ESP_ERROR_CHECK_WITHOUT_ABORT(write_nvs(sync_time));
+  }
+  seal_block();
+  xSemaphoreGive(state_mutex);
+}
+
+void persistent_state_record_position(time_t time, int32_t latitude_e7,
+                                      int32_t longitude_e7) {
+  xSemaphoreTake(state_mutex, portMAX_DELAY);
+  rtc_block.state.position = {.time = time,
+                              .latitude_e7 = latitude_e7,
+                              .longitude_e7 = longitude_e7};
+  rtc_block.dirty = true;
+  seal_block();
+  xSemaphoreGive(state_mutex);
+}
+
+esp_err_t persistent_state_commit(time_t now, bool force) {
+  esp_err_t err = ESP_OK;
+  xSemaphoreTake(state_mutex, portMAX_DELAY);
+  if (rtc_block.dirty &&
+      (force || now - rtc_block.last_nvs_write_time >= kNvsWriteInterval)) {
+    err = write_nvs(now);
+    seal_block();
+  }
+  xSemaphoreGive(state_mutex);
+  return err;
+}
@@ -0,0 +1,74 @@
+#include <cstring>
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <esp_timer.h>
+
+#include "local_time.hpp"
+#include "timezone.hpp"
+#include "tz_index.hpp"
+
+static const char *TAG = "TZ";
+
+// The TZ set last. POSIX strings from the index are well below this.
+static char current_tz[64] = "UTC";
+
+esp_err_t timezone_apply_position(int32_t latitude_e7, int32_t longitude_e7) {
+  const esp_partition_t *partition = esp_partition_find_first(
+      ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS,
+      kTzPartitionLabel);
+  if (partition == nullptr) {
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  const int64_t start_us = esp_timer_get_time();
+  // Map the header first, then just as much as the index takes. It rarely
+  // fills the partition, and every mapped 64 KB page takes an MMU entry.
+  const void *data = nullptr;
+  esp_partition_mmap_handle_t handle;
+  esp_err_t err =
+      esp_partition_mmap(partition, 0, kTzIndexHeaderSize,
+                         ESP_PARTITION_MMAP_DATA, &data, &handle);
+  if (err != ESP_OK) {
+    return err;
+  }
+  const size_t size =
+      TzIndex::size_in_header(static_cast<const uint8_t *>(data));
+  esp_partition_munmap(handle);
+  if (size == 0 || size > partition->size) {
+    ESP_LOGW(TAG, "No timezone index in '%s'", kTzPartitionLabel);
+    return ESP_ERR_NOT_FOUND;
+  }
+  err = esp_partition_mmap(partition, 0, size, ESP_PARTITION_MMAP_DATA,
+                           &data, &handle);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  const TzIndex index(static_cast<const uint8_t *>(data), size);
+  if (!index.valid()) {
+    ESP_LOGW(TAG, "No timezone index in '%s'", kTzPartitionLabel);
+    esp_partition_munmap(handle);
+    return ESP_ERR_NOT_FOUND;
+  }
+  int depth = 0;
+  const uint16_t zone = index.lookup(latitude_e7, longitude_e7, &depth);
+  const char *posix = index.posix(zone);
+  err = ESP_ERR_NOT_FOUND;
+  bool changed = false;
+  if (posix != nullptr && std::strlen(posix) < sizeof(current_tz)) {
+    changed = std::strcmp(posix, current_tz) != 0;
+    std::strcpy(current_tz, posix);
+    err = ESP_OK;
+  }
+  const int64_t lookup_us = esp_timer_get_time() - start_us;
+  ESP_LOGI(TAG, "%s (%s) in %lld us, %d levels deep in a %u byte index",
+           zone != kTzZoneNone ? index.name(zone) : "?", current_tz,
+           static_cast<long long>(lookup_us), depth,
+           static_cast<unsigned>(index.size()));
+  esp_partition_munmap(handle);
+
+  if (changed) {
+    local_time_set_zone(current_tz);
+  }
+  return err;
+}
@@ -0,0 +1,60 @@
+#include <esp_attr.h>
+#include <esp_log.h>
+
+#include "wake_profiler.hpp"
+
+static const char *TAG = "PROFILE";
+
+static const char *const kPhaseNames[] = {
+    "light", "battery", "timekeeping", "timesync", "led", "commit", "cycle",
+};
+static_assert(sizeof(kPhaseNames) / sizeof(kPhaseNames[0]) ==
+                  static_cast<size_t>(WakePhase::kCount),
+              "every phase needs a name");
+
+struct PhaseStats {
+  uint32_t count;
+  uint32_t min_us;
+  uint32_t max_us;
+  uint64_t total_us;
+};
+
+static RTC_DATA_ATTR PhaseStats
+    phase_stats[static_cast<size_t>(WakePhase::kCount)];
+static RTC_DATA_ATTR uint32_t cycles_since_report;
+
+void profiler_record(WakePhase phase, int64_t duration_us) {
+  PhaseStats &stats = phase_stats[static_cast<size_t>(phase)];
+  const uint32_t us = duration_us > 0 ? static_cast<uint32_t>(duration_us) : 0;
+  if (stats.count == 0 || us < stats.min_us)
+    stats.min_us = us;
+  if (us > stats.max_us)
+    stats.max_us = us;
+  stats.total_us += us;
+  stats.count++;
+}
+
+void profiler_report() {
+  ESP_LOGI(TAG, "%lu cycles, times in us (n min/avg/max)",
+           static_cast<unsigned long>(cycles_since_report));
+  for (size_t i = 0; i < static_cast<size_t>(WakePhase::kCount); i++) {
+    PhaseStats &stats = phase_stats[i];
+    if (stats.count == 0) {
+      continue;
+    }
+    ESP_LOGI(TAG, "%-11s %4lu %7lu/%7lu/%7lu", kPhaseNames[i],
+             static_cast<unsigned long>(stats.count),
+             static_cast<unsigned long>(stats.min_us),
+             static_cast<unsigned long>(stats.total_us / stats.count),
+             static_cast<unsigned long>(stats.max_us));
+    stats = {};
+  }
+  cycles_since_report = 0;
+}
+
+void profiler_end_cycle(int64_t cycle_start_us) {
+  profiler_record(WakePhase::kCycle, esp_timer_get_time() - cycle_start_us);
+  if (++cycles_since_report >= kProfilerReportInterval) {
+    profiler_report();
+  }
+}
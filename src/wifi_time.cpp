@@ -1,177 +1,310 @@
+#include <cstring>
+#include <esp_attr.h>
 #include <esp_event.h>
 #include <esp_log.h>
+#include <esp_netif.h>
+#include <esp_timer.h>
+#include <esp_wifi.h>
 #include <freertos/FreeRTOS.h>
-#include <freertos/task.h>
-#include <lwip/err.h>
-#include <lwip/sys.h>
-#include <nvs_flash.h>
-#include <stdio.h>
-#include <string.h>
+#include <freertos/event_groups.h>
+#include <lwip/netdb.h>
+#include <lwip/sockets.h>
+#include <sys/time.h>
 
-#include <esp_sntp.h>
-#include <string>
-
-#include "helpers.hpp"
+#include "ntp.hpp"
+#include "persistent_state.hpp"
 #include "wifi_time.hpp"
 
-static const char *TAG = "wifi_scan";
-
-// void WifiTime::time_sync_notification_cb(const timeval *tv)
-// {
-//     ESP_LOGI(TAG, "Notification of a time synchronization event");
-// }
-
-// Initialize the static instance pointer
-WiFiEventHandler *WiFiEventHandler::instance = nullptr;
-
-void WiFiEventHandler::handleEvent(esp_event_base_t event_base,
-                                   int32_t event_id, void *event_data) {
-  ESP_LOGI(TAG, "event_base: %s, event_id: %d", event_base,
-           static_cast<int>(event_id));
-  if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
-    // if scanning for open wifis, we do not want to directly connect after
-    // starting the station
-    if (m_connect_to_preconfigured_station) {
-      ESP_LOGI(TAG, "esp_wifi_connect");
-      wifi_config_t wifi_config;
-      if (esp_wifi_get_config(WIFI_IF_STA, &wifi_config) == ESP_OK) {
-        ESP_LOGI(TAG, "Currently set SSID: %s", wifi_config.sta.ssid);
-        ESP_LOGI(TAG, "Currently set pw: %s", wifi_config.sta.password);
-      } else {
-        ESP_LOGI(TAG, "Failed to get Wi-Fi configuration\n");
-      }
-      ESP_ERROR_CHECK(esp_wifi_connect());
-    }
-  } else if (event_base == WIFI_EVENT &&
-             event_id == WIFI_EVENT_STA_DISCONNECTED) {
-    wifi_event_sta_disconnected_t *event =
-        (wifi_event_sta_disconnected_t *)event_data;
-    ESP_LOGI(TAG, "connect to the AP fail. Reason: %d", event->reason);
-    if (m_retry_num < 5) {
-      esp_wifi_connect();
-      m_retry_num++;
-      ESP_LOGI(TAG, "retry to connect to the AP");
-    }
-  } else if (event_base == IP_EVENT && (event_id == IP_EVENT_STA_GOT_IP ||
-                                        event_id == IP_EVENT_GOT_IP6)) {
-    m_retry_num = 0;
-    ESP_LOGI(TAG, "Connected to AP, begin NTP sync");
-    // m_wifi_time.configureSNTP();
-  }
-}
-
-void WifiTime::setup_stack() {
-  // Initialize NVS - required for WIFI
-  esp_err_t ret = nvs_flash_init();
-  if (ret == ESP_ERR_NVS_NO_FREE_PAGES ||
-      ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-    ESP_ERROR_CHECK(nvs_flash_erase());
-    ret = nvs_flash_init();
-  }
-  ESP_ERROR_CHECK(ret);
+static const char *TAG = "WIFI_TIME";
 
-  ESP_ERROR_CHECK(esp_netif_init());
+static constexpr EventBits_t kConnectedBit = BIT0;
+static constexpr EventBits_t kGotIpBit = BIT1;
+static constexpr EventBits_t kDisconnectedBit = BIT2;
+// Answers that aren't ours are skipped, but not forever
+static constexpr int kSntpMaxStrayAnswers = 3;
 
-  ESP_ERROR_CHECK(esp_event_loop_create_default());
-  esp_netif_create_default_wifi_sta();
-  wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-  ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+// What makes a reconnect fast, kept through deep sleep. Addresses are in
+// network byte order.
+struct WifiFastConnect {
+  bool valid; // bssid and channel are set
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint32_t ip; // DHCP lease, 0 if none
+  uint32_t netmask;
+  uint32_t gateway;
+  uint32_t dns;
+  int64_t lease_time; // UTC seconds the lease was obtained
+  uint32_t server_ip; // kSntpServer resolved, 0 if not yet
+};
 
-  // Register event handlers
-  esp_event_handler_instance_t instance_got_ip;
-  ESP_ERROR_CHECK(esp_event_handler_instance_register(
-      IP_EVENT, IP_EVENT_STA_GOT_IP, &WiFiEventHandler::eventHandlerCallback,
-      NULL, &instance_got_ip));
+static RTC_DATA_ATTR WifiFastConnect fast_connect;
+static EventGroupHandle_t wifi_events = nullptr;
+static esp_netif_t *wifi_netif = nullptr;
 
-  esp_event_handler_instance_t instance_got_ip6;
-  ESP_ERROR_CHECK(esp_event_handler_instance_register(
-      IP_EVENT, IP_EVENT_GOT_IP6, &WiFiEventHandler::eventHandlerCallback, NULL,
-      &instance_got_ip6));
+static void on_event(void *arg, esp_event_base_t base, int32_t id,
+                     void *data) {
+  if (base == WIFI_EVENT && id == WIFI_EVENT_STA_CONNECTED) {
+    xEventGroupSetBits(wifi_events, kConnectedBit);
+  } else if (base == WIFI_EVENT && id == WIFI_EVENT_STA_DISCONNECTED) {
+    xEventGroupSetBits(wifi_events, kDisconnectedBit);
+  } else if (base == IP_EVENT && id == IP_EVENT_STA_GOT_IP) {
+    xEventGroupSetBits(wifi_events, kGotIpBit);
+  }
+}
 
-  esp_event_handler_instance_t instance_any_id;
-  ESP_ERROR_CHECK(esp_event_handler_instance_register(
-      WIFI_EVENT, ESP_EVENT_ANY_ID, &WiFiEventHandler::eventHandlerCallback,
-      NULL, &instance_any_id));
+// Network interface and event handlers stay around between syncs, the
+// driver itself only lives for one
+static esp_err_t init_once() {
+  if (wifi_events != nullptr) {
+    return ESP_OK;
+  }
+  esp_err_t err = esp_netif_init();
+  if (err != ESP_OK) {
+    return err;
+  }
+  err = esp_event_loop_create_default();
+  if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+    return err;
+  }
+  wifi_netif = esp_netif_create_default_wifi_sta();
+  esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, on_event, nullptr);
+  esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, on_event,
+                             nullptr);
+  wifi_events = xEventGroupCreate();
+  return ESP_OK;
+}
 
-  ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+static int64_t local_now_us() {
+  timeval now;
+  gettimeofday(&now, NULL);
+  return now.tv_sec * 1000000LL + now.tv_usec;
 }
-void WifiTime::configureSNTP() { // Initialize SNTP
-  esp_sntp_setoperatingmode(ESP_SNTP_OPMODE_POLL);
-  esp_sntp_setservername(0, "pool.ntp.org");
-  // esp_sntp_set_time_sync_notification_cb(WifiTime::time_sync_notification_cb);
 
-  esp_sntp_init();
+// The static address, or the cached lease while it is fresh. Returns
+// false if DHCP has to run.
+static bool configure_address(int64_t now) {
+  esp_netif_ip_info_t ip_info = {};
+  esp_netif_dns_info_t dns = {};
+  if (kWifiStaticIp[0] != '\0') {
+    esp_netif_str_to_ip4(kWifiStaticIp, &ip_info.ip);
+    esp_netif_str_to_ip4(kWifiNetmask, &ip_info.netmask);
+    esp_netif_str_to_ip4(kWifiGateway, &ip_info.gw);
+    dns.ip.u_addr.ip4 = ip_info.gw;
+  } else if (fast_connect.ip != 0 && now >= fast_connect.lease_time &&
+             now - fast_connect.lease_time < kWifiLeaseReuseS) {
+    ip_info.ip.addr = fast_connect.ip;
+    ip_info.netmask.addr = fast_connect.netmask;
+    ip_info.gw.addr = fast_connect.gateway;
+    dns.ip.u_addr.ip4.addr = fast_connect.dns;
+  } else {
+    esp_netif_dhcpc_start(wifi_netif);
+    return false;
+  }
+  esp_netif_dhcpc_stop(wifi_netif);
+  esp_netif_set_ip_info(wifi_netif, &ip_info);
+  dns.ip.type = ESP_IPADDR_TYPE_V4;
+  esp_netif_set_dns_info(wifi_netif, ESP_NETIF_DNS_MAIN, &dns);
+  return true;
 }
 
-void WifiTime::connect(const std::string ssid, const std::string pass) {
-  wifi_config_t wifi_config{};
+// Associates and waits for an address. With `fast` goes straight to the
+// cached access point on its channel instead of scanning for the SSID.
+static bool wifi_connect(bool fast, bool static_address, TickType_t timeout) {
+  wifi_config_t config = {};
+  // Both may fill their field without a terminator
+  strncpy(reinterpret_cast<char *>(config.sta.ssid), kWifiSsid,
+          sizeof(config.sta.ssid));
+  strncpy(reinterpret_cast<char *>(config.sta.password), kWifiPassword,
+          sizeof(config.sta.password));
+  if (fast) {
+    config.sta.bssid_set = true;
+    memcpy(config.sta.bssid, fast_connect.bssid, sizeof(config.sta.bssid));
+    config.sta.channel = fast_connect.channel;
+    config.sta.scan_method = WIFI_FAST_SCAN;
+  } else {
+    config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+  }
+  esp_wifi_set_config(WIFI_IF_STA, &config);
 
-  std::copy(ssid.begin(), ssid.end(), wifi_config.sta.ssid);
-  wifi_config.sta.ssid[ssid.size()] = '\0';
+  xEventGroupClearBits(wifi_events,
+                       kConnectedBit | kGotIpBit | kDisconnectedBit);
+  if (esp_wifi_connect() != ESP_OK) {
+    return false;
+  }
+  // A set address doesn't wait for DHCP
+  const EventBits_t ready = static_address ? kConnectedBit : kGotIpBit;
+  const EventBits_t bits = xEventGroupWaitBits(
+      wifi_events, ready | kDisconnectedBit, pdFALSE, pdFALSE, timeout);
+  return (bits & ready) != 0 && (bits & kDisconnectedBit) == 0;
+}
 
-  std::copy(pass.begin(), pass.end(), wifi_config.sta.password);
-  wifi_config.sta.password[pass.size()] = '\0';
+static void remember_access_point() {
+  wifi_ap_record_t ap;
+  if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+    memcpy(fast_connect.bssid, ap.bssid, sizeof(fast_connect.bssid));
+    fast_connect.channel = ap.primary;
+    fast_connect.valid = true;
+  }
+}
 
-  ESP_LOGI(TAG, "Setting wifi config to [%s/%s]",
-           reinterpret_cast<char *>(wifi_config.sta.ssid),
-           reinterpret_cast<char *>(wifi_config.sta.password));
-  ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
-  esp_wifi_start();
+static void remember_lease(int64_t now) {
+  esp_netif_ip_info_t ip_info;
+  esp_netif_dns_info_t dns;
+  if (esp_netif_get_ip_info(wifi_netif, &ip_info) != ESP_OK ||
+      esp_netif_get_dns_info(wifi_netif, ESP_NETIF_DNS_MAIN, &dns) !=
+          ESP_OK) {
+    return;
+  }
+  fast_connect.ip = ip_info.ip.addr;
+  fast_connect.netmask = ip_info.netmask.addr;
+  fast_connect.gateway = ip_info.gw.addr;
+  fast_connect.dns = dns.ip.u_addr.ip4.addr;
+  fast_connect.lease_time = now;
 }
 
-void WifiTime::scanForWifi() {
-  esp_wifi_start();
+// kSntpServer as an address, from the cache if it had to be looked up.
+// Returns 0 if it can't be resolved.
+static uint32_t resolve_server() {
+  in_addr address;
+  if (inet_aton(kSntpServer, &address) != 0) {
+    return address.s_addr;
+  }
+  if (fast_connect.server_ip != 0) {
+    return fast_connect.server_ip;
+  }
+  addrinfo hints = {};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  addrinfo *result = nullptr;
+  if (getaddrinfo(kSntpServer, nullptr, &hints, &result) != 0 ||
+      result == nullptr) {
+    return 0;
+  }
+  fast_connect.server_ip =
+      reinterpret_cast<sockaddr_in *>(result->ai_addr)->sin_addr.s_addr;
+  freeaddrinfo(result);
+  return fast_connect.server_ip;
+}
 
-  static constexpr uint16_t kMaxAps{20};
-  wifi_ap_record_t ap_records[kMaxAps];
+// One request, one answer
+static bool query_server(uint32_t server_ip, NtpResult &result) {
+  const int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (sock < 0) {
+    return false;
+  }
+  const timeval timeout = {.tv_sec = 0,
+                           .tv_usec = kSntpResponseTimeoutMs * 1000};
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  sockaddr_in server = {};
+  server.sin_family = AF_INET;
+  server.sin_port = htons(kNtpPort);
+  server.sin_addr.s_addr = server_ip;
 
-  while (true) {
-    uint16_t ap_count = kMaxAps;
-    memset(ap_records, 0, sizeof(ap_records));
+  uint8_t packet[kNtpPacketLength];
+  const int64_t transmit_us = local_now_us();
+  ntp_request(transmit_us, packet);
+  bool answered = false;
+  if (sendto(sock, packet, sizeof(packet), 0,
+             reinterpret_cast<sockaddr *>(&server),
+             sizeof(server)) == sizeof(packet)) {
+    for (int i = 0; i < kSntpMaxStrayAnswers && !answered; i++) {
+      const int length = recv(sock, packet, sizeof(packet), 0);
+      const int64_t receive_us = local_now_us();
+      if (length < 0) {
+        break;
+      }
+      answered = ntp_parse_response(packet, length, transmit_us, receive_us,
+                                    result);
+    }
+  }
+  close(sock);
+  return answered;
+}
 
-    ESP_ERROR_CHECK(esp_wifi_scan_start(NULL, true));
-    ESP_ERROR_CHECK(esp_wifi_scan_get_ap_records(&ap_count, ap_records));
-    ESP_LOGI(TAG, "Total APs scanned = %u", ap_count);
+esp_err_t wifi_time_sync() {
+  if (!wifi_time_configured()) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  esp_err_t err = init_once();
+  if (err != ESP_OK) {
+    return err;
+  }
+  const wifi_init_config_t init_config = WIFI_INIT_CONFIG_DEFAULT();
+  err = esp_wifi_init(&init_config);
+  if (err != ESP_OK) {
+    return err;
+  }
+  // The configuration changes with every sync, keep it out of NVS
+  esp_wifi_set_storage(WIFI_STORAGE_RAM);
+  esp_wifi_set_mode(WIFI_MODE_STA);
 
-    for (int i = 0; i < ap_count; i++) {
-      std::string ssid = reinterpret_cast<char *>(ap_records[i].ssid);
-      ESP_LOGI(TAG, "> Wi-Fi: %s", ssid.c_str());
+  const int64_t start_us = esp_timer_get_time();
+  const bool fast = fast_connect.valid;
+  bool static_address = configure_address(time(nullptr));
+  esp_wifi_start();
+  bool connected = fast && wifi_connect(true, static_address,
+                                        pdMS_TO_TICKS(kWifiFastPathTimeoutMs));
+  if (!connected) {
+    if (fast) {
+      // Moved or replaced, and its lease may be gone with it
+      ESP_LOGW(TAG, "Cached access point didn't answer, scanning");
+      esp_wifi_disconnect();
+      fast_connect.valid = false;
+      fast_connect.ip = 0;
+      static_address = configure_address(time(nullptr));
     }
+    connected = wifi_connect(false, static_address,
+                             pdMS_TO_TICKS(kWifiSlowPathTimeoutMs));
+  }
 
-    for (int i = 0; i < ap_count; i++) {
-      if (ap_records[i].authmode == WIFI_AUTH_OPEN) {
-        std::string ssid = reinterpret_cast<char *>(ap_records[i].ssid);
-        ESP_LOGI(TAG, "Found open Wi-Fi: %s", ssid.c_str());
-
-        wifi_config_t wifi_config = {0};
-        strcpy((char *)(wifi_config.sta.ssid), ssid.c_str());
-        ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
-        esp_wifi_start();
-        ESP_LOGI(TAG, "Connecting to %s...", ssid.c_str());
-        if (esp_wifi_connect() != ESP_OK) {
-          continue;
-        }
-
-        // Wait for time to be set
-        struct tm timeinfo = {0};
-        int retry = 0;
-        const int retry_count = 10;
-        while (!time_is_synchronized(timeinfo) && ++retry < retry_count) {
-          ESP_LOGI(TAG, "Waiting for system time to be set... (%d/%d)", retry,
-                   retry_count);
-          vTaskDelay(2000 / portTICK_PERIOD_MS);
-          printTimeInfo(timeinfo);
-        }
-
-        if (retry == retry_count) {
-          continue;
-        }
-
-        ESP_LOGI(TAG, "Time synchronized");
-        vTaskDelete(NULL); // Cleanly deletes the task
+  NtpResult result = {};
+  bool synced = false;
+  if (connected) {
+    remember_access_point();
+    const uint32_t server_ip = resolve_server();
+    synced = server_ip != 0 && query_server(server_ip, result);
+    if (synced && !ntp_offset_plausible(persistent_state_get().drift,
+                                        local_now_us(), result.offset_us)) {
+      ESP_LOGW(TAG, "Server puts the clock %lld s off, ignoring it",
+               static_cast<long long>(result.offset_us / 1000000));
+      synced = false;
+    }
+    if (synced) {
+      const int64_t local_us = local_now_us();
+      const int64_t utc_us = local_us + result.offset_us;
+      const timeval utc = {.tv_sec = static_cast<time_t>(utc_us / 1000000),
+                           .tv_usec =
+                               static_cast<suseconds_t>(utc_us % 1000000)};
+      settimeofday(&utc, NULL);
+      persistent_state_record_sync(utc_us, local_us, SyncQuality::kSntp);
+      if (!static_address) {
+        remember_lease(utc.tv_sec);
       }
+    } else {
+      // Look it up again next time, the cached address may be stale
+      fast_connect.server_ip = 0;
     }
+  }
+  esp_wifi_disconnect();
+  esp_wifi_stop();
+  esp_wifi_deinit();
+  const uint32_t radio_ms = (esp_timer_get_time() - start_us) / 1000;
 
-    ESP_LOGE(TAG, "No open wifis!");
+  auto state = persistent_state_get();
+  if (synced) {
+    sntp_attempt_on_success(state.sntp, radio_ms, result.delay_us);
+    ESP_LOGI(TAG,
+             "Synced via %s path, offset %lld us, delay %lld us, stratum "
+             "%u, radio on %lu ms",
+             fast ? "fast" : "slow", static_cast<long long>(result.offset_us),
+             static_cast<long long>(result.delay_us), result.stratum,
+             static_cast<unsigned long>(radio_ms));
+  } else {
+    sntp_attempt_on_failure(state.sntp, time(nullptr));
+    ESP_LOGW(TAG, "No time (%s), radio on %lu ms",
+             connected ? "no answer" : "not connected",
+             static_cast<unsigned long>(radio_ms));
   }
+  persistent_state_set(state, false);
+  return synced ? ESP_OK : ESP_FAIL;
 }
@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+"""A local NTP server to test the clock's SNTP sync against.
+
+Answers every client request with the host's time, shifted by --offset so a
+sync visibly moves the clock, and logs each request with the round trip the
+client will see. Point kSntpServer in include/wifi_time.hpp at the host's
+address, then:
+
+    sudo tools/ntp_standin.py --offset 2.5
+
+--drop makes it ignore that fraction of requests and --delay holds each
+answer back, to exercise the timeout and the backoff. --stratum 0 or --leap
+3 answer like an unsynchronized server, which the clock has to reject.
+
+Only the standard library is needed. Port 123 needs root, --port picks
+another one for a client on the same host.
+"""
+
+import argparse
+import random
+import socket
+import struct
+import sys
+import time
+
+NTP_UNIX_OFFSET = 2208988800  # kNtpUnixOffsetS
+PACKET_LENGTH = 48
+MODE_CLIENT = 3
+MODE_SERVER = 4
+
+
+def to_ntp(unix_s):
+    seconds = int(unix_s)
+    fraction = int((unix_s - seconds) * (1 << 32))
+    return struct.pack(">II", (seconds + NTP_UNIX_OFFSET) & 0xFFFFFFFF,
+                       fraction)
+
+
+def answer(request, receive_s, args):
+    version = (request[0] >> 3) & 0x07
+    header = struct.pack(">BBbb", (args.leap << 6) | (version << 3) |
+                         MODE_SERVER, args.stratum, 4, -20)
+    root = struct.pack(">II", 0, 0) + b"LOCL"
+    reference = to_ntp(receive_s - 16)
+    originate = request[40:48]
+    return header + root + reference + originate + to_ntp(receive_s)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__, formatter_class=argparse.RawTextHelpFormatter)
+    parser.add_argument("--bind", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=123)
+    parser.add_argument("--offset", type=float, default=0.0,
+                        help="seconds added to the host time")
+    parser.add_argument("--delay", type=float, default=0.0,
+                        help="seconds to hold each answer back")
+    parser.add_argument("--drop", type=float, default=0.0,
+                        help="fraction of requests to ignore")
+    parser.add_argument("--stratum", type=int, default=1)
+    parser.add_argument("--leap", type=int, default=0, choices=range(4))
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind((args.bind, args.port))
+    print(f"NTP stand-in on {args.bind}:{args.port}, offset {args.offset} s",
+          file=sys.stderr)
+    while True:
+        request, client = sock.recvfrom(512)
+        receive_s = time.time() + args.offset
+        if len(request) < PACKET_LENGTH or request[0] & 0x07 != MODE_CLIENT:
+            print(f"{client[0]}: not a client request, ignored",
+                  file=sys.stderr)
+            continue
+        if random.random() < args.drop:
+            print(f"{client[0]}: dropped", file=sys.stderr)
+            continue
+        if args.delay > 0:
+            time.sleep(args.delay)
+        reply = answer(request, receive_s, args)
+        reply += to_ntp(time.time() + args.offset)
+        sock.sendto(reply, client)
+        seconds, fraction = struct.unpack(">II", request[40:48])
+        client_s = seconds - NTP_UNIX_OFFSET + fraction / (1 << 32)
+        print(f"{client[0]}: client clock {client_s:.6f}, "
+              f"off by {receive_s - client_s:+.3f} s", file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
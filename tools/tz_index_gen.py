@@ -0,0 +1,346 @@
+#!/usr/bin/env python3
+"""Builds the timezone index the clock looks its position up in.
+
+Input is a GeoJSON FeatureCollection of timezone polygons with a "tzid"
+property, e.g. timezones-with-oceans.geojson from
+https://github.com/evansiroky/timezone-boundary-builder/releases. The POSIX TZ
+string of each zone is taken from the footer of the host's compiled zoneinfo.
+
+The output is the binary format described in include/tz_index.hpp: a grid of
+--cell degree cells over the world, each split as a quadtree down to --depth
+levels where a zone border runs through it. Write it to the spiffs partition,
+the firmware maps it from there:
+
+    tools/tz_index_gen.py timezones-with-oceans.geojson tz_index.bin
+    parttool.py write_partition --partition-name spiffs --input tz_index.bin
+
+Only the standard library is needed. A full world at the defaults takes a few
+minutes.
+"""
+
+import argparse
+import json
+import os
+import random
+import struct
+import sys
+import time
+
+MAGIC = b"TZQ1"
+VERSION = 1
+HEADER_SIZE = 32
+REF_LEAF = 0x80000000
+MAX_DEPTH = 12  # kTzIndexMaxDepth
+PARTITION_SIZE = 0xF0000  # spiffs in partition.csv
+
+# Coordinates are handled in 1e-7 degrees, offset to the SW corner of the
+# world, with the same integer cell math as the firmware
+WORLD_W = 3600000000
+WORLD_H = 1800000000
+
+
+def simplify(points, tolerance):
+    """Douglas-Peucker on a closed ring of (x, y)"""
+    if tolerance <= 0 or len(points) < 5:
+        return points
+    keep = [False] * len(points)
+    keep[0] = keep[-1] = True
+    stack = [(0, len(points) - 1)]
+    while stack:
+        first, last = stack.pop()
+        x1, y1 = points[first]
+        x2, y2 = points[last]
+        dx, dy = x2 - x1, y2 - y1
+        norm = (dx * dx + dy * dy) ** 0.5
+        worst, worst_i = -1.0, -1
+        for i in range(first + 1, last):
+            px, py = points[i]
+            if norm == 0:
+                d = ((px - x1) ** 2 + (py - y1) ** 2) ** 0.5
+            else:
+                d = abs(dy * px - dx * py + x2 * y1 - y2 * x1) / norm
+            if d > worst:
+                worst, worst_i = d, i
+        if worst > tolerance:
+            keep[worst_i] = True
+            stack.append((first, worst_i))
+            stack.append((worst_i, last))
+    return [p for p, k in zip(points, keep) if k]
+
+
+class Zone:
+    """All rings of one feature. Inside is decided even-odd over all of
+    them, which takes care of holes and multipolygons alike."""
+
+    def __init__(self, tzid, rings, band_h):
+        self.tzid = tzid
+        self.edges = []
+        for ring in rings:
+            for (x1, y1), (x2, y2) in zip(ring, ring[1:]):
+                if (x1, y1) != (x2, y2):
+                    self.edges.append((x1, y1, x2, y2))
+        xs = [c for e in self.edges for c in (e[0], e[2])] or [0]
+        ys = [c for e in self.edges for c in (e[1], e[3])] or [0]
+        self.bbox = (min(xs), min(ys), max(xs), max(ys))
+        # Edges by grid row, so a ray only looks at its own band
+        self.bands = {}
+        for e in self.edges:
+            lo = int(min(e[1], e[3]) // band_h)
+            hi = int(max(e[1], e[3]) // band_h)
+            for band in range(lo, hi + 1):
+                self.bands.setdefault(band, []).append(e)
+        self.band_h = band_h
+
+    def contains(self, x, y):
+        inside = False
+        for x1, y1, x2, y2 in self.bands.get(int(y // self.band_h), ()):
+            if (y1 > y) != (y2 > y):
+                if x < x1 + (y - y1) * (x2 - x1) / (y2 - y1):
+                    inside = not inside
+        return inside
+
+
+def crosses(e, x0, y0, x1, y1):
+    """Whether a segment touches the box, Liang-Barsky"""
+    ax, ay, bx, by = e
+    if max(ax, bx) < x0 or min(ax, bx) > x1:
+        return False
+    if max(ay, by) < y0 or min(ay, by) > y1:
+        return False
+    dx, dy = bx - ax, by - ay
+    t0, t1 = 0.0, 1.0
+    for p, q in ((-dx, ax - x0), (dx, x1 - ax), (-dy, ay - y0), (dy, y1 - ay)):
+        if p == 0:
+            if q < 0:
+                return False
+        else:
+            t = q / p
+            if p < 0:
+                if t > t1:
+                    return False
+                t0 = max(t0, t)
+            else:
+                if t < t0:
+                    return False
+                t1 = min(t1, t)
+    return True
+
+
+def load_zones(path, tolerance, band_h):
+    with open(path) as f:
+        collection = json.load(f)
+    zones = []
+    for feature in collection["features"]:
+        geometry = feature["geometry"]
+        if geometry["type"] == "Polygon":
+            polygons = [geometry["coordinates"]]
+        elif geometry["type"] == "MultiPolygon":
+            polygons = geometry["coordinates"]
+        else:
+            continue
+        rings = []
+        for polygon in polygons:
+            for ring in polygon:
+                points = [(round((lon + 180) * 1e7), round((lat + 90) * 1e7))
+                          for lon, lat in ring]
+                points = simplify(points, tolerance * 1e7)
+                if len(points) >= 4:
+                    rings.append(points)
+        if rings:
+            zone = Zone(feature["properties"]["tzid"], rings, band_h)
+            if zone.edges:
+                zones.append(zone)
+    return zones
+
+
+def posix_tz(tzid, zoneinfo):
+    """The POSIX TZ footer of a version 2+ TZif file"""
+    with open(os.path.join(zoneinfo, tzid), "rb") as f:
+        data = f.read()
+    if data[:4] != b"TZif" or data[4:5] < b"2":
+        sys.exit(f"{tzid}: no POSIX footer in zoneinfo")
+    footer = data.rstrip(b"\n").rsplit(b"\n", 1)[-1].decode()
+    if not footer:
+        sys.exit(f"{tzid}: empty POSIX footer")
+    return footer
+
+
+def nautical_tzid(x):
+    """Etc zone by longitude, for sea the input doesn't cover"""
+    hours = max(-12, min(12, round((x / 1e7 - 180) / 15)))
+    # Etc signs are the POSIX ones, inverted
+    return "Etc/GMT" if hours == 0 else f"Etc/GMT{-hours:+d}"
+
+
+class Builder:
+    def __init__(self, zones, depth):
+        self.zones = zones
+        self.depth = depth
+        self.zone_ids = {}
+        self.nodes = []
+        self.max_depth_used = 0
+
+    def zone_id(self, tzid):
+        return self.zone_ids.setdefault(tzid, len(self.zone_ids))
+
+    def zone_at(self, candidates, x, y):
+        for zone, _ in candidates:
+            if zone.contains(x, y):
+                return zone.tzid
+        return nautical_tzid(x)
+
+    def build(self, candidates, x0, y0, w, h, level):
+        """Ref for the box. `candidates` are the zones whose bbox touches
+        it, with their edges that might cross it."""
+        x1, y1 = x0 + w, y0 + h
+        cx, cy = x0 + w / 2, y0 + h / 2
+        partial = []
+        for zone, edges in candidates:
+            inside = [e for e in edges if crosses(e, x0, y0, x1, y1)]
+            if inside:
+                partial.append((zone, inside))
+            elif zone.contains(cx, cy):
+                # No border runs through, so the whole box is this zone
+                return REF_LEAF | self.zone_id(zone.tzid)
+        if not partial:
+            return REF_LEAF | self.zone_id(nautical_tzid(cx))
+        if level == self.depth:
+            return REF_LEAF | self.zone_id(self.zone_at(partial, cx, cy))
+
+        self.max_depth_used = max(self.max_depth_used, level + 1)
+        half_w, half_h = w // 2, h // 2
+        quarters = [(x0, y0, half_w, half_h),
+                    (x0 + half_w, y0, w - half_w, half_h),
+                    (x0, y0 + half_h, half_w, h - half_h),
+                    (x0 + half_w, y0 + half_h, w - half_w, h - half_h)]
+        refs = [self.build(partial, qx, qy, qw, qh, level + 1)
+                for qx, qy, qw, qh in quarters]
+        if all(r & REF_LEAF for r in refs) and len(set(refs)) == 1:
+            return refs[0]
+        self.nodes.append(refs)
+        return len(self.nodes) - 1
+
+
+def lookup(grid, nodes, columns, rows, x, y):
+    """The firmware's TzIndex::lookup(), for --verify"""
+    cell_w, cell_h = WORLD_W // columns, WORLD_H // rows
+    column = min(x // cell_w, columns - 1)
+    row = min(y // cell_h, rows - 1)
+    cx, cy = x - column * cell_w, y - row * cell_h
+    ref = grid[row * columns + column]
+    while not ref & REF_LEAF:
+        cell_w //= 2
+        cell_h //= 2
+        quarter = 0
+        if cx >= cell_w:
+            quarter |= 1
+            cx -= cell_w
+        if cy >= cell_h:
+            quarter |= 2
+            cy -= cell_h
+        ref = nodes[ref][quarter]
+    return ref & 0xFFFF
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__, formatter_class=argparse.RawTextHelpFormatter)
+    parser.add_argument("geojson")
+    parser.add_argument("output")
+    parser.add_argument("--cell", type=float, default=1.0,
+                        help="grid cell size in degrees (default 1)")
+    parser.add_argument("--depth", type=int, default=6,
+                        help="quadtree levels below the grid (default 6, "
+                             "1/64 degree, about 1.7 km)")
+    parser.add_argument("--simplify", type=float, default=0.005,
+                        help="polygon simplification tolerance in degrees")
+    parser.add_argument("--zoneinfo", default="/usr/share/zoneinfo")
+    parser.add_argument("--partition-size", type=lambda s: int(s, 0),
+                        default=PARTITION_SIZE)
+    parser.add_argument("--verify", type=int, default=10000, metavar="N",
+                        help="random points to check against the polygons")
+    args = parser.parse_args()
+
+    if not 0 <= args.depth <= MAX_DEPTH:
+        sys.exit(f"--depth must be 0..{MAX_DEPTH}")
+    columns, rows = round(360 / args.cell), round(180 / args.cell)
+    cell_w, cell_h = WORLD_W // columns, WORLD_H // rows
+
+    start = time.time()
+    zones = load_zones(args.geojson, args.simplify, cell_h)
+    print(f"{len(zones)} zones, {sum(len(z.edges) for z in zones)} edges "
+          f"after simplification")
+
+    builder = Builder(zones, args.depth)
+    grid = []
+    for row in range(rows):
+        y0 = row * cell_h
+        y1 = WORLD_H if row == rows - 1 else y0 + cell_h
+        in_row = [z for z in zones if z.bbox[1] <= y1 and z.bbox[3] >= y0]
+        for column in range(columns):
+            x0 = column * cell_w
+            x1 = WORLD_W if column == columns - 1 else x0 + cell_w
+            candidates = [(z, z.bands.get(row, [])) for z in in_row
+                          if z.bbox[0] <= x1 and z.bbox[2] >= x0]
+            grid.append(builder.build(candidates, x0, y0, x1 - x0, y1 - y0,
+                                      0))
+        if sys.stderr.isatty():
+            print(f"\r{row + 1}/{rows} rows, {len(builder.nodes)} nodes",
+                  end="", file=sys.stderr)
+    print(file=sys.stderr)
+
+    tzids = sorted(builder.zone_ids, key=builder.zone_ids.get)
+    strings = b""
+    offsets = []
+    grid_offset = HEADER_SIZE
+    node_offset = grid_offset + len(grid) * 4
+    zone_offset = node_offset + len(builder.nodes) * 16
+    strings_offset = zone_offset + len(tzids) * 4
+    for tzid in tzids:
+        offsets.append(strings_offset + len(strings))
+        posix = posix_tz(tzid, args.zoneinfo)
+        strings += tzid.encode() + b"\0" + posix.encode() + b"\0"
+    size = strings_offset + len(strings)
+
+    out = struct.pack("<4sHHHHIIIII", MAGIC, VERSION, len(tzids), columns,
+                      rows, grid_offset, node_offset, len(builder.nodes),
+                      zone_offset, size)
+    out += struct.pack(f"<{len(grid)}I", *grid)
+    for refs in builder.nodes:
+        out += struct.pack("<4I", *refs)
+    out += struct.pack(f"<{len(offsets)}I", *offsets)
+    out += strings
+    assert len(out) == size
+    with open(args.output, "wb") as f:
+        f.write(out)
+
+    print(f"built in {time.time() - start:.0f} s")
+    print(f"grid    {columns}x{rows}, {len(grid) * 4} bytes")
+    print(f"nodes   {len(builder.nodes)}, {len(builder.nodes) * 16} bytes, "
+          f"{builder.max_depth_used} levels deep")
+    print(f"zones   {len(tzids)}, {len(tzids) * 4 + len(strings)} bytes")
+    print(f"total   {size} bytes, {100 * size / args.partition_size:.0f}% "
+          f"of the partition")
+
+    if args.verify > 0:
+        rng = random.Random(1)
+        mismatches = 0
+        for _ in range(args.verify):
+            x = rng.randrange(WORLD_W)
+            y = rng.randrange(WORLD_H)
+            expected = builder.zone_at([(z, None) for z in zones], x, y)
+            found = tzids[lookup(grid, builder.nodes, columns, rows, x, y)]
+            # Open sea is only resolved to the grid cell
+            sea = expected.startswith("Etc/") and found.startswith("Etc/")
+            if found != expected and not sea:
+                mismatches += 1
+        print(f"verify  {mismatches} of {args.verify} random points differ "
+              f"from the simplified polygons")
+
+    if size > args.partition_size:
+        sys.exit(f"{size} bytes don't fit the {args.partition_size} byte "
+                 f"partition, use a smaller --depth")
+
+
+if __name__ == "__main__":
+    main()